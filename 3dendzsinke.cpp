@@ -1,39 +1,24 @@
 #include "framework.h"
-#include <cstdlib>
-#include <math.h>
-
-//---------------------------
-template<class T> struct Dnum { // Dual numbers for automatic derivation
-//---------------------------
-	float f; // function value
-	T d;  // derivatives
-	Dnum(float f0 = 0, T d0 = T(0)) { f = f0, d = d0; }
-	Dnum operator+(Dnum r) { return Dnum(f + r.f, d + r.d); }
-	Dnum operator-(Dnum r) { return Dnum(f - r.f, d - r.d); }
-	Dnum operator*(Dnum r) {
-		return Dnum(f * r.f, f * r.d + d * r.f);
-	}
-	Dnum operator/(Dnum r) {
-		return Dnum(f / r.f, (r.f * d - r.d * f) / r.f / r.f);
-	}
-};
-
-// Elementary functions prepared for the chain rule as well
-template<class T> Dnum<T> Exp(Dnum<T> g) { return Dnum<T>(expf(g.f), expf(g.f)*g.d); }
-template<class T> Dnum<T> Sin(Dnum<T> g) { return  Dnum<T>(sinf(g.f), cosf(g.f)*g.d); }
-template<class T> Dnum<T> Cos(Dnum<T>  g) { return  Dnum<T>(cosf(g.f), -sinf(g.f)*g.d); }
-template<class T> Dnum<T> Tan(Dnum<T>  g) { return Sin(g) / Cos(g); }
-template<class T> Dnum<T> Sinh(Dnum<T> g) { return  Dnum<T>(sinh(g.f), cosh(g.f)*g.d); }
-template<class T> Dnum<T> Cosh(Dnum<T> g) { return  Dnum<T>(cosh(g.f), sinh(g.f)*g.d); }
-template<class T> Dnum<T> Tanh(Dnum<T> g) { return Sinh(g) / Cosh(g); }
-template<class T> Dnum<T> Log(Dnum<T> g) { return  Dnum<T>(logf(g.f), g.d / g.f); }
-template<class T> Dnum<T> Pow(Dnum<T> g, float n) {
-	return  Dnum<T>(powf(g.f, n), n * powf(g.f, n - 1) * g.d);
-}
-
-typedef Dnum<vec2> Dnum2;
-
-const int tessellationLevel = 20;
+#include "physics.h"
+
+const bool checkNoiseGrid = false; // compare the table-driven Noise grid against the Dnum path at startup
+const bool gpuTerrain = false; // flat grid displaced by the noise sum in the vertex shader
+const bool clipmapTerrain = false; // nested grids around the drone camera, heights from toroidal textures
+const bool quadtreeTerrain = false; // chunked LOD terrain, culled and refined per viewport
+const int gpuTerrainResolution = 100; // cells per edge of the flat grid displaced in the vertex shader
+const bool profileTerrain = false; // print the GPU time of the frames
+const bool orbitCamera = true; // the drone of the right viewport circles the terrain; a resting scene is redrawn unless it stands
+const bool bakedLighting = false; // terrain ambient (with occlusion) and diffuse baked per vertex, only specular per pixel
+const bool benchmarkIntegrators = false; // print energy drift and cost of the integrators at startup
+const bool benchmarkCrowd = false; // print the BodySystem deviation from Body and its bodies*steps/s at startup
+const bool benchmarkThreads = false; // print the BodySystem scaling with the number of threads at startup
+const bool benchmarkBroadphase = false; // print the cost of the crowd contact search against testing all pairs at startup
+const bool benchmarkEvents = false; // print the cost and the taut overshoot of fixed and event-driven stepping at startup
+const bool benchmarkTunneling = false; // print how many fast boxes pass a thin ridge and each other, without and with sweeps
+const bool benchmarkRope = false; // print the peak stretch error and cost of the XPBD rope by segment count at startup
+const bool physicsThread = false; // simulation on its own thread, the frames draw the latest snapshot it published
+const char * const sessionRecord = nullptr; // log seed, parameters and key presses of the run here, e.g. "session.jmp"
+const char * const sessionReplay = nullptr; // drive the run from this log instead of the keyboard
 
 //---------------------------
 struct Camera { // 3D camera
@@ -317,7 +302,11 @@ class MyShader : public Shader {
 		}
 	)";
 public:
-	MyShader() { create(vertexSource, fragmentSource, "fragmentColor"); }
+	// variants may replace the stages, a vertex shader has to provide the same outputs
+	MyShader(const char * customVertexSource = nullptr, const char * customFragmentSource = nullptr) {
+		create(customVertexSource ? customVertexSource : vertexSource,
+		       customFragmentSource ? customFragmentSource : fragmentSource, "fragmentColor");
+	}
 
 	void Bind(RenderState state) {
 		Use(); 		// make this program run
@@ -334,6 +323,301 @@ public:
 	}
 };
 
+// MyShader vertex stage that displaces a flat y = 0 grid by sum A cos(2pi(i x + j z + B)) and derives the normal
+const char * const noiseVertexSource = R"(
+	#version 330
+	precision highp float;
+
+	struct Light {
+		vec3 La, Le;
+		vec4 wLightPos;
+	};
+
+	uniform mat4  MVP, M, Minv; // MVP, Model, Model-inverse
+	uniform Light[8] lights;    // light sources 
+	uniform int   nLights;
+	uniform vec3  wEye;         // pos of eye
+	uniform int   nTerms;
+	uniform float time;
+	layout(std140) uniform NoiseTerms {
+		vec4 terms[1024];       // (i, j, A, B)
+	};
+	layout(std140) uniform NoiseDrift {
+		vec4 drift[256];        // phase velocity of term k in drift[k / 4][k % 4]
+	};
+
+	layout(location = 0) in vec3  vtxPos;            // pos in modeling space
+	layout(location = 1) in vec3  vtxNorm;      	 // normal in modeling space
+	layout(location = 2) in vec2  vtxUV;
+
+	out vec3 wNormal;		    // normal in world space
+	out vec3 wView;             // view in world space
+	out vec3 wLight[8];		    // light dir in world space
+	out vec2 texcoord;
+	out float h;
+
+	void main() {
+		const float twoPi = 6.28318531;
+		vec3 pos = vtxPos;
+		vec2 dh = vec2(0, 0);   // dh/dx, dh/dz
+		pos.y = 0;
+		for(int k = 0; k < nTerms; k++) {
+			vec4 t = terms[k];
+			float phase = twoPi * (t.x * pos.x + t.y * pos.z + t.w + drift[k / 4][k % 4] * time);
+			pos.y += t.z * cos(phase);
+			dh -= t.z * sin(phase) * twoPi * t.xy;
+		}
+		vec3 normal = cross(vec3(1, dh.x, 0), vec3(0, dh.y, 1));
+
+		gl_Position = vec4(pos, 1) * MVP; // to NDC
+		h = pos.y;
+		// vectors for radiance computation
+		vec4 wPos = vec4(pos, 1) * M;
+		for(int i = 0; i < nLights; i++) {
+			wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
+		}
+		wView  = wEye * wPos.w - wPos.xyz;
+		wNormal = (Minv * vec4(normal, 0)).xyz;
+		texcoord = vtxUV;
+	}
+)";
+
+// MyShader stages for terrain with baked view independent lighting in attribute 3
+const char * const bakedVertexSource = R"(
+	#version 330
+	precision highp float;
+
+	struct Light {
+		vec3 La, Le;
+		vec4 wLightPos;
+	};
+
+	uniform mat4  MVP, M, Minv; // MVP, Model, Model-inverse
+	uniform Light[8] lights;    // light sources 
+	uniform int   nLights;
+	uniform vec3  wEye;         // pos of eye
+
+	layout(location = 0) in vec3  vtxPos;            // pos in modeling space
+	layout(location = 1) in vec3  vtxNorm;      	 // normal in modeling space
+	layout(location = 2) in vec2  vtxUV;
+	layout(location = 3) in vec3  vtxBaked;          // ambient and diffuse radiance
+
+	out vec3 wNormal;		    // normal in world space
+	out vec3 wView;             // view in world space
+	out vec3 wLight[8];		    // light dir in world space
+	out vec2 texcoord;
+	out float h;
+	out vec3 baked;
+
+	void main() {
+		gl_Position = vec4(vtxPos, 1) * MVP; // to NDC
+		h = vtxPos.y;
+		baked = vtxBaked;
+		// vectors for radiance computation
+		vec4 wPos = vec4(vtxPos, 1) * M;
+		for(int i = 0; i < nLights; i++) {
+			wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
+		}
+		wView  = wEye * wPos.w - wPos.xyz;
+		wNormal = (Minv * vec4(vtxNorm, 0)).xyz;
+		texcoord = vtxUV;
+	}
+)";
+
+const char * const bakedFragmentSource = R"(
+	#version 330
+	precision highp float;
+
+	struct Light {
+		vec3 La, Le;
+		vec4 wLightPos;
+	};
+
+	struct Material {
+		vec3 kd, ks, ka;
+		float shininess;
+	};
+
+	uniform Material material;
+	uniform Light[8] lights;    // light sources 
+	uniform int   nLights;
+
+	in  vec3 wNormal;       // interpolated world sp normal
+	in  vec3 wView;         // interpolated world sp view
+	in  vec3 wLight[8];     // interpolated world sp illum dir
+	in  vec2 texcoord;
+	in  float h;
+	in  vec3 baked;         // ambient and diffuse terms of every light
+	
+	out vec4 fragmentColor; // output goes to frame buffer
+
+	void main() {
+		vec3 N = normalize(wNormal);
+		vec3 V = normalize(wView); 
+		if (dot(N, V) < 0) N = -N;
+		vec3 radiance = baked;
+		for(int i = 0; i < nLights; i++) {
+			vec3 H = normalize(normalize(wLight[i]) + V);
+			radiance += material.ks * pow(max(dot(N,H), 0), material.shininess) * lights[i].Le;
+		}
+		fragmentColor = vec4(radiance, 1);
+	}
+)";
+
+//---------------------------
+class NoiseShader : public MyShader { // terrain evaluated on the GPU, reseeding and animation are uniform updates
+//---------------------------
+	unsigned int ubo[2] = { 0, 0 }; // terms, phase velocities
+	int nTerms = 0;
+	float time = 0;
+public:
+	static const int maxTerms = 1024; // 16 KB, the minimum uniform block size every GL 3.3 driver supports
+
+	NoiseShader() : MyShader(noiseVertexSource) {
+		glGenBuffers(2, ubo);
+		std::vector<float> zeros(maxTerms, 0.0f);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo[0]);
+		glBufferData(GL_UNIFORM_BUFFER, maxTerms * sizeof(vec4), nullptr, GL_DYNAMIC_DRAW);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo[1]);
+		glBufferData(GL_UNIFORM_BUFFER, maxTerms * sizeof(float), &zeros[0], GL_DYNAMIC_DRAW);
+		glUniformBlockBinding(getId(), glGetUniformBlockIndex(getId(), "NoiseTerms"), 0);
+		glUniformBlockBinding(getId(), glGetUniformBlockIndex(getId(), "NoiseDrift"), 1);
+	}
+
+	void SetTerms(const std::vector<vec4>& terms) { // (i, j, A, B) per term
+		nTerms = std::min((int)terms.size(), maxTerms);
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo[0]);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, nTerms * sizeof(vec4), &terms[0]);
+	}
+
+	void SetDrifts(const std::vector<float>& drifts) { // phase velocity per term, in the order of the terms
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo[1]);
+		glBufferSubData(GL_UNIFORM_BUFFER, 0, std::min((int)drifts.size(), maxTerms) * sizeof(float), &drifts[0]);
+	}
+
+	void SetTime(float t) { time = t; }
+
+	void Bind(RenderState state) {
+		MyShader::Bind(state);
+		setUniform(nTerms, "nTerms");
+		setUniform(time, "time");
+		glBindBufferBase(GL_UNIFORM_BUFFER, 0, ubo[0]);
+		glBindBufferBase(GL_UNIFORM_BUFFER, 1, ubo[1]);
+	}
+
+	~NoiseShader() { glDeleteBuffers(2, ubo); }
+};
+
+//---------------------------
+class FrameTimer { // average frame interval and GPU time; query results are read a few frames late so the CPU never waits
+//---------------------------
+	static const int latency = 4, window = 300;
+	unsigned int queries[latency];
+	int frame = 0, count = 0;
+	double gpuTotal = 0;
+	std::chrono::steady_clock::time_point windowStart;
+	const char * label;
+public:
+	FrameTimer(const char * _label) : label(_label) { glGenQueries(latency, queries); }
+
+	void Begin() {
+		if (count == 0) windowStart = std::chrono::steady_clock::now();
+		glBeginQuery(GL_TIME_ELAPSED, queries[frame % latency]);
+	}
+
+	// software rasterizers may report no GPU time, the frame interval includes their work through back pressure
+	void End() {
+		glEndQuery(GL_TIME_ELAPSED);
+		if (++frame < latency) return;
+		GLuint64 ns = 0;
+		glGetQueryObjectui64v(queries[frame % latency], GL_QUERY_RESULT, &ns);
+		gpuTotal += ns * 1e-6;
+		if (++count == window) {
+			double wall = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - windowStart).count();
+			printf("%s: %.3f ms per frame, %.3f ms GPU\n", label, wall / count, gpuTotal / count);
+			gpuTotal = 0;
+			count = 0;
+		}
+	}
+
+	~FrameTimer() { glDeleteQueries(latency, queries); }
+};
+
+// MyShader vertex stage of one clipmap level: grid index -> modeling position, height and derivatives from a
+// toroidally addressed texture layer, blended toward the next coarser level near the border of the level
+const char * const clipmapVertexSource = R"(
+	#version 330
+	precision highp float;
+
+	struct Light {
+		vec3 La, Le;
+		vec4 wLightPos;
+	};
+
+	uniform mat4  MVP, M, Minv; // MVP, Model, Model-inverse
+	uniform Light[8] lights;    // light sources 
+	uniform int   nLights;
+	uniform vec3  wEye;         // pos of eye
+	uniform sampler2DArray heightMaps; // (h, dh/dx, dh/dz) per level, texel = grid index mod n
+	uniform int   level, coarsest, n;
+	uniform vec2  origin;       // grid index of the first vertex of the level
+	uniform float spacing;      // grid spacing of the level in modeling space
+	uniform vec2  viewer;       // clipmap center in modeling space
+
+	layout(location = 0) in vec2  vtxGrid;           // grid index inside the level
+
+	out vec3 wNormal;		    // normal in world space
+	out vec3 wView;             // view in world space
+	out vec3 wLight[8];		    // light dir in world space
+	out vec2 texcoord;
+	out float h;
+
+	void main() {
+		vec2 g = origin + vtxGrid;
+		vec2 xz = g * spacing;
+		vec3 s = texelFetch(heightMaps, ivec3(mod(g, float(n)), level), 0).xyz;
+		if (level < coarsest) {
+			float w = float(n) / 10;  // transition width in cells
+			vec2 d = abs(xz - viewer) / spacing;
+			float alpha = clamp((max(d.x, d.y) - (float(n - 1) / 2 - 2 - w)) / w, 0, 1);
+			vec3 coarse = texture(heightMaps, vec3((xz / (2 * spacing) + 0.5) / float(n), level + 1)).xyz;
+			s = mix(s, coarse, alpha);
+		}
+		vec3 pos = vec3(xz.x, s.x, xz.y);
+		vec3 normal = cross(vec3(1, s.y, 0), vec3(0, s.z, 1));
+
+		gl_Position = vec4(pos, 1) * MVP; // to NDC
+		h = pos.y;
+		// vectors for radiance computation
+		vec4 wPos = vec4(pos, 1) * M;
+		for(int i = 0; i < nLights; i++) {
+			wLight[i] = lights[i].wLightPos.xyz * wPos.w - wPos.xyz * lights[i].wLightPos.w;
+		}
+		wView  = wEye * wPos.w - wPos.xyz;
+		wNormal = (Minv * vec4(normal, 0)).xyz;
+		texcoord = xz + 0.5;
+	}
+)";
+
+//---------------------------
+class ClipmapShader : public MyShader {
+//---------------------------
+public:
+	ClipmapShader() : MyShader(clipmapVertexSource) { }
+
+	void SetLevel(int level, int coarsest, int n, vec2 origin, float spacing, vec2 viewer, unsigned int heightMaps) {
+		setUniform(level, "level");
+		setUniform(coarsest, "coarsest");
+		setUniform(n, "n");
+		setUniform(origin, "origin");
+		setUniform(spacing, "spacing");
+		setUniform(viewer, "viewer");
+		setUniform(0, "heightMaps");
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, heightMaps);
+	}
+};
+
 //---------------------------
 class Geometry {
 //---------------------------
@@ -347,50 +631,61 @@ public:
 		glBindBuffer(GL_ARRAY_BUFFER, vbo);
 	}
 	virtual void Draw() = 0;
-	~Geometry() {
+	virtual ~Geometry() {
 		glDeleteBuffers(1, &vbo);
 		glDeleteVertexArrays(1, &vao);
 	}
 };
 
 //---------------------------
-class ParamSurface : public Geometry {
+class SurfaceMesh : public Geometry { // triangle strips through the vertices of a ParamSurface
 //---------------------------
-	struct VertexData {
-		vec3 position, normal;
-		vec2 texcoord;
-	};
-
+	typedef ParamSurface::VertexData VertexData;
 	unsigned int nVtxPerStrip, nStrips;
+	unsigned int colorVbo = 0;
 public:
-	ParamSurface() { nVtxPerStrip = nStrips = 0; }
-
-	virtual void eval(Dnum2& U, Dnum2& V, Dnum2& X, Dnum2& Y, Dnum2& Z) = 0;
-
-	VertexData GenVertexData(float u, float v) {
-		VertexData vtxData;
-		vtxData.texcoord = vec2(u, v);
-		Dnum2 X, Y, Z;
-		Dnum2 U(u, vec2(1, 0)), V(v, vec2(0, 1));
-		eval(U, V, X, Y, Z);
-		vtxData.position = vec3(X.f, Y.f, Z.f);
-		vec3 drdU(X.d.x, Y.d.x, Z.d.x), drdV(X.d.y, Y.d.y, Z.d.y);
-		vtxData.normal = cross(drdU, drdV);
-		return vtxData;
+	ParamSurface * surface;
+
+	SurfaceMesh(ParamSurface * _surface, int N = tessellationLevel, int M = tessellationLevel) : surface(_surface) { create(N, M); }
+
+	int Rows() const { return nStrips; }                 // N of create()
+	int Columns() const { return nVtxPerStrip / 2 - 1; } // M of create()
+
+	// Per-vertex color in attribute 3, one value per vertex of the (N+1) x (M+1) grid of create()
+	void SetVertexColors(const std::vector<vec3>& colors) {
+		int N = Rows(), M = Columns();
+		std::vector<vec3> strips;
+		strips.reserve(nVtxPerStrip * nStrips);
+		for (int i = 0; i < N; i++) {
+			for (int j = 0; j <= M; j++) {
+				strips.push_back(colors[i * (M + 1) + j]);
+				strips.push_back(colors[(i + 1) * (M + 1) + j]);
+			}
+		}
+		glBindVertexArray(vao);
+		if (colorVbo == 0) glGenBuffers(1, &colorVbo);
+		glBindBuffer(GL_ARRAY_BUFFER, colorVbo);
+		glBufferData(GL_ARRAY_BUFFER, strips.size() * sizeof(vec3), &strips[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(3);  // attribute array 3 = COLOR
+		glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, 0, NULL);
 	}
 
-	void create(int N = tessellationLevel, int M = tessellationLevel) {
-		nVtxPerStrip = (M + 1) * 2;
-		nStrips = N;
+	~SurfaceMesh() { if (colorVbo) glDeleteBuffers(1, &colorVbo); }
+
+	// Triangle strip order of a grid: N strips of (M+1) vertex pairs
+	static std::vector<VertexData> Strips(int N, int M, const std::vector<VertexData>& grid) {
 		std::vector<VertexData> vtxData;	// vertices on the CPU
+		vtxData.reserve((M + 1) * 2 * N);
 		for (int i = 0; i < N; i++) {
 			for (int j = 0; j <= M; j++) {
-				vtxData.push_back(GenVertexData((float)j / M, (float)i / N));
-				vtxData.push_back(GenVertexData((float)j / M, (float)(i + 1) / N));
+				vtxData.push_back(grid[i * (M + 1) + j]);
+				vtxData.push_back(grid[(i + 1) * (M + 1) + j]);
 			}
 		}
-		glBufferData(GL_ARRAY_BUFFER, nVtxPerStrip * nStrips * sizeof(VertexData), &vtxData[0], GL_STATIC_DRAW);
-		// Enable the vertex attribute arrays
+		return vtxData;
+	}
+
+	static void EnableVertexAttributes() {
 		glEnableVertexAttribArray(0);  // attribute array 0 = POSITION
 		glEnableVertexAttribArray(1);  // attribute array 1 = NORMAL
 		glEnableVertexAttribArray(2);  // attribute array 2 = TEXCOORD0
@@ -400,6 +695,16 @@ public:
 		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(VertexData), (void*)offsetof(VertexData, texcoord));
 	}
 
+	void create(int N, int M) {
+		nVtxPerStrip = (M + 1) * 2;
+		nStrips = N;
+		std::vector<VertexData> grid((N + 1) * (M + 1)); // every vertex is evaluated once, strips share rows
+		surface->GenGrid(N, M, grid);
+		std::vector<VertexData> vtxData = Strips(N, M, grid);
+		glBufferData(GL_ARRAY_BUFFER, nVtxPerStrip * nStrips * sizeof(VertexData), &vtxData[0], GL_STATIC_DRAW);
+		EnableVertexAttributes();
+	}
+
 	void Draw() {
 		glBindVertexArray(vao);
 		for (unsigned int i = 0; i < nStrips; i++) 
@@ -459,68 +764,39 @@ const int Cube::indecies[][2] = {
 
 
 
-class Noise : public ParamSurface {
-	constexpr  static int n = 3;
-	Dnum2 A[n][n];
-	Dnum2 B[n][n];
+//---------------------------
+class FlatGrid : public ParamSurface { // reusable y = 0 grid, displaced in NoiseShader
+//---------------------------
 public:
-	Noise() { 
-		initA(); 
-		create();
-	}
-
-	void initA() {
-		for(int i = 0; i < n; i++) {
-			for(int j = 0; j < n; j++) {
-				if (i == 0 && j == 0) {
-					A[i][j] = 0;
-				}else {
-					A[i][j] = (1/sqrtf(i*i + j*j));
-					B[i][j] = (float)rand()/(float)RAND_MAX;
-				}
-			}
-		}
-	}
-
 	void eval(Dnum2 &U, Dnum2 &V, Dnum2 &X, Dnum2 &Y, Dnum2 &Z) override {
-		X = U-0.5;
-		Z = V-0.5;
+		X = U - 0.5;
 		Y = 0;
-		for(int i = 0; i < n; i++) {
-			for (int j = 0; j < n; j++) {
-				Y = Y + Cos((X * i + Z * j + B[i][j]) * M_PI * 2) * A[i][j];	
-			}
-		}
+		Z = V - 0.5;
 	}
-};	
-
+};
 
 //---------------------------
-struct Object {
+struct Object : public Placement {
 //---------------------------
 	Shader *   shader;
 	Material * material;
 	Texture *  texture;
 	Geometry * geometry;
-	vec3 scale, translation, rotationAxis;
-	float rotationAngle;
 public:
-	Object(Shader * _shader, Material * _material, Texture * _texture, Geometry * _geometry) :
-		scale(vec3(1, 1, 1)), translation(vec3(0, 0, 0)), rotationAxis(0, 0, 0), rotationAngle(0) {
+	Object(Shader * _shader, Material * _material, Texture * _texture, Geometry * _geometry) {
 		shader = _shader;
 		texture = _texture;
 		material = _material;
 		geometry = _geometry;
 	}
 
-	virtual void SetModelingTransform(mat4& M, mat4& Minv) {
-		M = ScaleMatrix(scale) * RotationMatrix(rotationAngle, rotationAxis) * TranslateMatrix(translation);
-		Minv = TranslateMatrix(-translation) * RotationMatrix(-rotationAngle, rotationAxis) * ScaleMatrix(vec3(1 / scale.x, 1 / scale.y, 1 / scale.z));
-	}
-
-	void Draw(RenderState state) {
+	virtual void Draw(RenderState state) {
 		mat4 M, Minv;
 		SetModelingTransform(M, Minv);
+		DrawAt(state, M, Minv);
+	}
+
+	void DrawAt(RenderState state, const mat4& M, const mat4& Minv) { // with the given modeling transform
 		state.M = M;
 		state.Minv = Minv;
 		state.MVP = state.M * state.V * state.P;
@@ -529,66 +805,612 @@ public:
 		shader->Bind(state);
 		geometry->Draw();
 	}
+};
+
+//---------------------------
+class RopeLine : public Geometry { // polyline through the rope particles
+//---------------------------
+	int nVertices = 0;
+public:
+	RopeLine() { SurfaceMesh::EnableVertexAttributes(); }
+
+	void Upload(const std::vector<vec3>& points) {
+		std::vector<ParamSurface::VertexData> vtxData(points.size());
+		for (size_t i = 0; i < points.size(); i++) {
+			vtxData[i].position = points[i];
+			vtxData[i].normal = vec3(0, 1, 0);
+			vtxData[i].texcoord = vec2(0, (float)i / points.size());
+		}
+		nVertices = (int)points.size();
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		glBufferData(GL_ARRAY_BUFFER, nVertices * sizeof(ParamSurface::VertexData), &vtxData[0], GL_STREAM_DRAW);
+	}
 
-	virtual void Animate(float tstart, float tend) { rotationAngle = 0.0f * tend; }
+	void Draw() {
+		glBindVertexArray(vao);
+		glDrawArrays(GL_LINE_STRIP, 0, nVertices);
+	}
 };
 
-bool goon = false;
-struct Body : public Object {
-	float m = 1;
-	vec3 g = vec3(0, -5, 0);
-	vec3 v = vec3(1, 0, 0);
-	float ro = 0.3;
-	vec3 s = vec3(0,5,0);
-	mat4 M, Minv;
-	float D = 1;
-	float l0 = 3;
-	vec3 w = vec3(0,0,0);
-	float kappa = 0.3;
-	
-	Body(Shader * _shader, Material * _material, Texture * _texture, Geometry * _geometry) 
-		:Object( _shader, _material, _texture, _geometry) {
+//---------------------------
+class RopeObject : public Object { // the particles of a Rope as a line
+//---------------------------
+	RopeLine * line;
+public:
+	std::vector<vec3> shown; // particles of the last snapshot, written by the frames only
+
+	RopeObject(Shader * _shader, Material * _material, Texture * _texture) : Object(_shader, _material, _texture, nullptr) {
+		rotationAxis = vec3(0, 1, 0);
+		geometry = line = new RopeLine();
+	}
+
+	~RopeObject() { delete line; }
+
+	void Draw(RenderState state) override { // the particles of the last snapshot
+		if (shown.empty()) return;
+		line->Upload(shown);
+		Object::Draw(state);
+	}
+};
+
+//---------------------------
+class BodyObject : public Object { // a Body drawn between the two steps of the last snapshot
+//---------------------------
+	const Body * body;
+public:
+	BodyPose shown[2]; // previous and current step of the last snapshot, written by the frames only
+	float alpha = 1;   // drawn at this fraction of the way from shown[0] to shown[1]
+
+	BodyObject(Shader * _shader, Material * _material, Texture * _texture, Geometry * _geometry, const Body * _body)
+		: Object(_shader, _material, _texture, _geometry), body(_body) {
+		shown[0] = shown[1] = body->Pose();
+	}
+
+	// Modeling transform of the shown poses interpolated at alpha
+	void RenderTransform(mat4& RM, mat4& RMinv) const {
+		body->Transform(shown[0].Lerp(shown[1], alpha), RM, RMinv);
+	}
+
+	void Draw(RenderState state) override {
+		mat4 RM, RMinv;
+		RenderTransform(RM, RMinv);
+		DrawAt(state, RM, RMinv);
+	}
+};
+
+//---------------------------
+class CrowdObject : public Object { // the boxes of a BodySystem
+//---------------------------
+	const BodySystem * crowd;
+public:
+	std::vector<vec4> shown; // position and angle of the bodies at the last snapshot, written by the frames only
+
+	CrowdObject(Shader * _shader, Material * _material, Texture * _texture, Geometry * _geometry, const BodySystem * _crowd)
+		: Object(_shader, _material, _texture, _geometry), crowd(_crowd) {
 		rotationAxis = vec3(0, 0, 1);
 	}
 
-	void Animate(float tstart, float tend) override {
-		if(!goon) {
-			return;
+	void Draw(RenderState state) override { // at the step of the last snapshot, no interpolation
+		for (int i = 0; i < (int)shown.size(); i++) {
+			translation = vec3(shown[i].x, shown[i].y, shown[i].z);
+			rotationAngle = shown[i].w;
+			scale = crowd->Extent(i);
+			Object::Draw(state);
 		}
+	}
+};
+
+//---------------------------
+class TerrainTile : public Geometry { // streamed terrain patch in a reusable GPU buffer
+//---------------------------
+	unsigned int nVtxPerStrip = 0, nStrips = 0;
+	size_t capacity = 0; // bytes allocated in the vbo
+public:
+	TerrainTile() { SurfaceMesh::EnableVertexAttributes(); }
+
+	void Upload(const std::vector<ParamSurface::VertexData>& vtxData, int N, int M) {
+		nVtxPerStrip = (M + 1) * 2;
+		nStrips = N;
+		size_t bytes = vtxData.size() * sizeof(ParamSurface::VertexData);
+		glBindBuffer(GL_ARRAY_BUFFER, vbo);
+		if (bytes > capacity) {
+			glBufferData(GL_ARRAY_BUFFER, bytes, &vtxData[0], GL_DYNAMIC_DRAW);
+			capacity = bytes;
+		} else {
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, &vtxData[0]);
+		}
+	}
+
+	void Draw() {
+		glBindVertexArray(vao);
+		for (unsigned int i = 0; i < nStrips; i++)
+			glDrawArrays(GL_TRIANGLE_STRIP, i * nVtxPerStrip, nVtxPerStrip);
+	}
+};
+
+//---------------------------
+class TerrainStreamer : public Object { // endless terrain: tiles around the cameras generated on worker threads
+//---------------------------
+	struct Tile {
+		TerrainTile * buffer;
+		long long lastUsed; // frame in which the tile was last wanted
+	};
+	struct TileData {
+		int x, z;
+		std::vector<ParamSurface::VertexData> vtxData;
+	};
+
+	ParamSurface * surface;
+	float tileSize;      // tile edge in the surface (u, v) parameters
+	int radius;          // tiles kept around a camera in each direction
+	int resolution;      // grid cells per tile edge
+	int uploadsPerFrame; // GL upload budget
+	unsigned int poolSize; // GPU buffers, the least recently used tile is evicted beyond this
+	long long frame = 0;
+
+	// GL thread only
+	std::unordered_map<long long, Tile> resident;
+	std::unordered_map<long long, bool> pending; // requested, not yet uploaded
+	std::vector<TerrainTile *> buffers;
+	std::vector<long long> visible;
+
+	// shared with the workers
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::deque<std::pair<int, int>> jobs;
+	std::vector<TileData> done;
+	bool quit = false;
+	std::vector<std::thread> workers;
+
+	static long long Key(int x, int z) { return ((long long)x << 32) ^ (unsigned int)z; }
+
+	void Worker() {
+		for (;;) {
+			std::pair<int, int> job;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeup.wait(lock, [this] { return quit || !jobs.empty(); });
+				if (quit) return;
+				job = jobs.front();
+				jobs.pop_front();
+			}
+			TileData data = { job.first, job.second, Generate(job.first, job.second) };
+			std::lock_guard<std::mutex> lock(mutex);
+			done.push_back(std::move(data));
+		}
+	}
+
+	std::vector<ParamSurface::VertexData> Generate(int x, int z) {
+		std::vector<ParamSurface::VertexData> grid((resolution + 1) * (resolution + 1));
+		surface->GenGrid(resolution, resolution, grid, vec2(x, z) * tileSize, vec2(x + 1, z + 1) * tileSize);
+		return SurfaceMesh::Strips(resolution, resolution, grid);
+	}
+
+	TerrainTile * AcquireBuffer() {
+		if (buffers.size() < poolSize) {
+			buffers.push_back(new TerrainTile());
+			return buffers.back();
+		}
+		auto lru = resident.end();
+		for (auto it = resident.begin(); it != resident.end(); ++it)
+			if (it->second.lastUsed < frame && (lru == resident.end() || it->second.lastUsed < lru->second.lastUsed)) lru = it;
+		if (lru == resident.end()) return nullptr; // every buffer holds a tile needed now
+		TerrainTile * buffer = lru->second.buffer;
+		resident.erase(lru);
+		return buffer;
+	}
+public:
+	TerrainStreamer(Shader * _shader, Material * _material, ParamSurface * _surface, float _tileSize = 1.0f / 3,
+	                int _radius = 4, int _resolution = tessellationLevel, int _uploadsPerFrame = 4, unsigned int _poolSize = 192,
+	                int nWorkers = 2) : Object(_shader, _material, nullptr, nullptr) {
+		surface = _surface;
+		tileSize = _tileSize;
+		radius = _radius;
+		resolution = _resolution;
+		uploadsPerFrame = _uploadsPerFrame;
+		poolSize = _poolSize;
+		for (int i = 0; i < nWorkers; i++) workers.emplace_back(&TerrainStreamer::Worker, this);
+	}
+
+	~TerrainStreamer() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wakeup.notify_all();
+		for (std::thread& worker : workers) worker.join();
+		for (TerrainTile * buffer : buffers) delete buffer;
+	}
+
+	bool Complete() const { return pending.empty(); } // every tile requested so far is drawn, GL thread
+
+	// Requests the tiles around the eyes and uploads finished ones within the budget; call on the GL thread once per frame
+	void Update(const std::vector<vec3>& eyes) {
+		frame++;
+		std::vector<std::pair<float, long long>> wanted; // (distance to the nearest eye, key)
+		std::unordered_map<long long, bool> wantedSet;
+		for (const vec3& eye : eyes) {
+			float u = (eye.x - translation.x) / scale.x + 0.5f, v = (eye.z - translation.z) / scale.z + 0.5f;
+			int cx = (int)floorf(u / tileSize), cz = (int)floorf(v / tileSize);
+			for (int z = cz - radius; z <= cz + radius; z++) {
+				for (int x = cx - radius; x <= cx + radius; x++) {
+					long long key = Key(x, z);
+					if (wantedSet.count(key)) continue;
+					wantedSet[key] = true;
+					float du = (x + 0.5f) * tileSize - u, dv = (z + 0.5f) * tileSize - v;
+					wanted.push_back(std::make_pair(du * du + dv * dv, key));
+				}
+			}
+		}
+		std::sort(wanted.begin(), wanted.end());
+
+		std::vector<TileData> finished;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (auto it = jobs.begin(); it != jobs.end();) { // drop requests that went out of range
+				long long key = Key(it->first, it->second);
+				if (wantedSet.count(key)) { ++it; continue; }
+				pending.erase(key);
+				it = jobs.erase(it);
+			}
+			for (auto& w : wanted) {
+				if (resident.count(w.second) || pending.count(w.second)) continue;
+				jobs.push_back(std::make_pair((int)(w.second >> 32), (int)(unsigned int)w.second));
+				pending[w.second] = true;
+			}
+			int n = std::min((int)done.size(), uploadsPerFrame);
+			finished.assign(std::make_move_iterator(done.begin()), std::make_move_iterator(done.begin() + n));
+			done.erase(done.begin(), done.begin() + n);
+		}
+		wakeup.notify_all();
+
+		for (auto& w : wanted) {
+			auto it = resident.find(w.second);
+			if (it != resident.end()) it->second.lastUsed = frame;
+		}
+		for (TileData& data : finished) {
+			long long key = Key(data.x, data.z);
+			pending.erase(key);
+			if (!wantedSet.count(key)) continue; // went out of range while generated, must not evict a tile of this frame
+			TerrainTile * buffer = AcquireBuffer();
+			if (!buffer) continue; // requested again next frame
+			buffer->Upload(data.vtxData, resolution, resolution);
+			resident[key] = Tile{ buffer, frame };
+		}
+
+		visible.clear();
+		for (auto& w : wanted) if (resident.count(w.second)) visible.push_back(w.second);
+	}
+
+	void Draw(RenderState state) override {
+		for (long long key : visible) {
+			geometry = resident[key].buffer;
+			Object::Draw(state);
+		}
+	}
+};
+
+//---------------------------
+class ClipmapGrid : public Geometry { // n x n grid indices with the static index buffers of the clipmap levels
+//---------------------------
+	unsigned int ibo[5];     // full grid, then rings with the hole at offset (n-1)/4 + (0|1, 0|1)
+	unsigned int nIndices[5];
+public:
+	const int n;
+
+	ClipmapGrid(int _n) : n(_n) { // n - 1 must be divisible by 4
+		std::vector<vec2> vtx(n * n);
+		for (int i = 0; i < n; i++) for (int j = 0; j < n; j++) vtx[i * n + j] = vec2((float)j, (float)i);
+		glBufferData(GL_ARRAY_BUFFER, vtx.size() * sizeof(vec2), &vtx[0], GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, NULL);
+		glGenBuffers(5, ibo);
+		for (int k = 0; k < 5; k++) {
+			int hx = (n - 1) / 4 + (k - 1) % 2, hz = (n - 1) / 4 + (k - 1) / 2, hole = (n - 1) / 2; // hole in cells
+			std::vector<unsigned int> idx;
+			for (int i = 0; i < n - 1; i++) {
+				for (int j = 0; j < n - 1; j++) {
+					if (k > 0 && i >= hz && i < hz + hole && j >= hx && j < hx + hole) continue;
+					unsigned int v = i * n + j;
+					unsigned int quad[6] = { v, v + 1, v + n, v + 1, v + n + 1, v + n };
+					idx.insert(idx.end(), quad, quad + 6);
+				}
+			}
+			nIndices[k] = (unsigned int)idx.size();
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo[k]);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, idx.size() * sizeof(unsigned int), &idx[0], GL_STATIC_DRAW);
+		}
+	}
+
+	void Draw(int variant) { // 0: full grid, 1 + dx + 2 dz: ring with hole shifted by (dx, dz) cells
+		glBindVertexArray(vao);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo[variant]);
+		glDrawElements(GL_TRIANGLES, nIndices[variant], GL_UNSIGNED_INT, NULL);
+	}
+
+	void Draw() { Draw(0); }
+
+	~ClipmapGrid() { glDeleteBuffers(5, ibo); }
+};
+
+//---------------------------
+class ClipmapTerrain : public Object { // geometry clipmap: constant vertex count and update cost for any terrain size
+//---------------------------
+	ParamSurface * surface;
+	ClipmapGrid * grid;
+	int nLevels;
+	float spacing0;                  // finest grid spacing in modeling space
+	unsigned int heightMaps = 0;     // n x n x nLevels RGB32F texture array
+	std::vector<int> originX, originZ; // grid index of the first vertex per level
+	std::vector<int> cachedX, cachedZ; // window resident in the texture per level
+	vec2 viewer;
+	bool valid = false;
+
+	// Evaluates the w x h samples starting at grid index (gx, gz) of a level and writes them toroidally
+	void Refresh(int level, int gx, int gz, int w, int h) {
+		if (w <= 0 || h <= 0) return;
+		int n = grid->n;
+		float s = spacing0 * (1 << level);
+		std::vector<ParamSurface::VertexData> samples((h + 1) * (w + 1));
+		surface->GenGrid(h, w, samples, vec2(gx * s + 0.5f, gz * s + 0.5f), vec2((gx + w) * s + 0.5f, (gz + h) * s + 0.5f));
+		std::vector<vec3> texels(w * h);
+		for (int i = 0; i < h; i++) {
+			for (int j = 0; j < w; j++) {
+				const ParamSurface::VertexData& v = samples[i * (w + 1) + j];
+				texels[i * w + j] = vec3(v.position.y, -v.normal.x / v.normal.y, -v.normal.z / v.normal.y);
+			}
+		}
+		glBindTexture(GL_TEXTURE_2D_ARRAY, heightMaps);
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+		for (int i = 0; i < h;) { // split where the window wraps around the texture
+			int ti = ((gz + i) % n + n) % n, hh = std::min(h - i, n - ti);
+			for (int j = 0; j < w;) {
+				int tj = ((gx + j) % n + n) % n, ww = std::min(w - j, n - tj);
+				glPixelStorei(GL_UNPACK_SKIP_ROWS, i);
+				glPixelStorei(GL_UNPACK_SKIP_PIXELS, j);
+				glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, tj, ti, level, ww, hh, 1, GL_RGB, GL_FLOAT, &texels[0]);
+				j += ww;
+			}
+			i += hh;
+		}
+		glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+		glPixelStorei(GL_UNPACK_SKIP_ROWS, 0);
+		glPixelStorei(GL_UNPACK_SKIP_PIXELS, 0);
+	}
+public:
+	ClipmapTerrain(ClipmapShader * _shader, Material * _material, ParamSurface * _surface, int n = 65, int _nLevels = 5,
+	               float _spacing0 = 1.0f / 128) : Object(_shader, _material, nullptr, nullptr) {
+		surface = _surface;
+		grid = new ClipmapGrid(n);
+		geometry = grid;
+		nLevels = _nLevels;
+		spacing0 = _spacing0;
+		originX.resize(nLevels); originZ.resize(nLevels);
+		cachedX.resize(nLevels); cachedZ.resize(nLevels);
+		glGenTextures(1, &heightMaps);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, heightMaps);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB32F, n, n, nLevels, 0, GL_RGB, GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	}
+
+	// Recenters the levels on the eye and re-evaluates only the rows and columns that entered a level
+	void Update(vec3 eye) {
+		mat4 M, Minv;
 		SetModelingTransform(M, Minv);
-		vec4 ll = vec4(0, -0.5, 0, 1) * M;
-		vec3 l = vec3(ll.x, ll.y, ll.z);
-		float dt = tend - tstart;
-		translation = translation + v * dt;
-		vec3 p = m * v;
-		vec3 K;	
-		if(length(s-l) > l0) {
-			K = D*(s-l)*(length(s-l) - l0);
-		}
-		vec3 F = m * g + K - ro * v;
-		p = p + F * dt;
-		v = p / m;
-		
-		float I = m * (scale.x * scale.x + scale.y * scale.y)/12;
-		vec3 L = I * w;
-		vec3 M = cross(l-translation, K) - kappa*w;
-		L = L + M * dt;
-		w = 1/I * L;
-		rotationAngle = rotationAngle - dot(rotationAxis, w)  * dt;
-			
+		vec4 p = vec4(eye.x, eye.y, eye.z, 1) * Minv;
+		viewer = vec2(p.x, p.z);
+		int n = grid->n;
+		// finest level centered on the viewer at an even index, coarser levels keep the finer one at offset (n-1)/4 or +1
+		originX[0] = 2 * (int)floorf((viewer.x / spacing0 - (n - 1) / 2) / 2);
+		originZ[0] = 2 * (int)floorf((viewer.y / spacing0 - (n - 1) / 2) / 2);
+		for (int l = 1; l < nLevels; l++) {
+			originX[l] = 2 * (int)floorf((originX[l - 1] / 2 - (n - 1) / 4) / 2.0f);
+			originZ[l] = 2 * (int)floorf((originZ[l - 1] / 2 - (n - 1) / 4) / 2.0f);
+		}
+		for (int l = 0; l < nLevels; l++) {
+			int ox = originX[l], oz = originZ[l], cx = cachedX[l], cz = cachedZ[l];
+			if (!valid || abs(ox - cx) >= n || abs(oz - cz) >= n) {
+				Refresh(l, ox, oz, n, n);
+			} else {
+				if (ox > cx) Refresh(l, cx + n, oz, ox - cx, n); // columns that entered, all rows
+				if (ox < cx) Refresh(l, ox, oz, cx - ox, n);
+				int x0 = std::max(ox, cx), x1 = std::min(ox, cx) + n; // rows that entered, columns not refreshed above
+				if (oz > cz) Refresh(l, x0, cz + n, x1 - x0, oz - cz);
+				if (oz < cz) Refresh(l, x0, oz, x1 - x0, cz - oz);
+			}
+			cachedX[l] = ox;
+			cachedZ[l] = oz;
+		}
+		valid = true;
+	}
+
+	void Draw(RenderState state) override {
+		mat4 M, Minv;
+		SetModelingTransform(M, Minv);
+		state.M = M;
+		state.Minv = Minv;
+		state.MVP = state.M * state.V * state.P;
+		state.material = material;
+		state.texture = texture;
+		shader->Bind(state);
+		int n = grid->n;
+		for (int l = 0; l < nLevels; l++) {
+			((ClipmapShader *)shader)->SetLevel(l, nLevels - 1, n, vec2((float)originX[l], (float)originZ[l]),
+			                                    spacing0 * (1 << l), viewer, heightMaps);
+			int variant = 0;
+			if (l > 0) variant = 1 + (originX[l - 1] / 2 - originX[l] - (n - 1) / 4) + 2 * (originZ[l - 1] / 2 - originZ[l] - (n - 1) / 4);
+			grid->Draw(variant);
+		}
+	}
+
+	~ClipmapTerrain() {
+		glDeleteTextures(1, &heightMaps);
+		delete grid;
+	}
+};
+
+//---------------------------
+class TerrainQuadtree : public Object { // chunks of a HeightQuadtree drawn frustum culled, refined by projected error
+//---------------------------
+	typedef HeightQuadtree::Node Node;
+	HeightQuadtree tree;
+	float pixelError;                 // refine while the projected error exceeds this
+	float skirt = 0;                  // modeling space depth of the curtains hiding cracks between levels
+	std::vector<TerrainTile *> meshes; // of the nodes in the preorder of the tree
+	std::vector<const Node *> selected;
+
+	TerrainTile * Mesh(const Node * node) { // chunk grid with one extra ring of vertices, dropped by the skirt depth where a neighbor chunk may meet it
+		int R = tree.ChunkRes(), fineRes = tree.FineRes(), i0 = node->i0, j0 = node->j0, stride = node->stride, cells = R * stride;
+		bool top = i0 > 0, bottom = i0 + cells < fineRes, left = j0 > 0, right = j0 + cells < fineRes;
+		std::vector<ParamSurface::VertexData> grid((R + 3) * (R + 3));
+		for (int i = 0; i <= R + 2; i++) {
+			for (int j = 0; j <= R + 2; j++) {
+				int ci = std::min(std::max(i - 1, 0), R), cj = std::min(std::max(j - 1, 0), R);
+				ParamSurface::VertexData v = tree.Fine(i0 + ci * stride, j0 + cj * stride);
+				if ((i == 0 && top) || (i == R + 2 && bottom) || (j == 0 && left) || (j == R + 2 && right)) v.position.y -= skirt;
+				grid[i * (R + 3) + j] = v;
+			}
+		}
+		TerrainTile * mesh = new TerrainTile();
+		mesh->Upload(SurfaceMesh::Strips(R + 2, R + 2, grid), R + 2, R + 2);
+		return mesh;
+	}
+
+	static bool Outside(const vec4 planes[6], vec3 bmin, vec3 bmax) { // box entirely behind one frustum plane
+		for (int k = 0; k < 6; k++) {
+			vec3 p(planes[k].x > 0 ? bmax.x : bmin.x, planes[k].y > 0 ? bmax.y : bmin.y, planes[k].z > 0 ? bmax.z : bmin.z);
+			if (planes[k].x * p.x + planes[k].y * p.y + planes[k].z * p.z + planes[k].w < 0) return true;
+		}
+		return false;
+	}
+
+	void Select(const Node * node, const vec4 planes[6], vec3 eye, float K) {
+		if (Outside(planes, node->bmin, node->bmax)) return;
+		vec3 closest(fminf(fmaxf(eye.x, node->bmin.x), node->bmax.x), fminf(fmaxf(eye.y, node->bmin.y), node->bmax.y),
+		             fminf(fmaxf(eye.z, node->bmin.z), node->bmax.z));
+		float distance = fmaxf(length(closest - eye), 1e-3f);
+		if (node->children[0] && node->error * K / distance > pixelError) {
+			for (const Node * child : node->children) Select(child, planes, eye, K);
+		} else {
+			selected.push_back(node);
+		}
+	}
+public:
+	TerrainQuadtree(Shader * _shader, Material * _material, int _chunkRes = 16, int _depth = 4, float _pixelError = 2)
+		: Object(_shader, _material, nullptr, nullptr), tree(_chunkRes, _depth) {
+		pixelError = _pixelError;
+	}
+
+	// Samples the surface once at the finest resolution and uploads every chunk; call after the modeling transform is set
+	void Build(ParamSurface * surface) {
+		tree.Build(surface, this);
+		float hmin = 1e30f, hmax = -1e30f;
+		for (int i = 0; i <= tree.FineRes(); i++) {
+			for (int j = 0; j <= tree.FineRes(); j++) {
+				hmin = fminf(hmin, tree.Fine(i, j).position.y);
+				hmax = fmaxf(hmax, tree.Fine(i, j).position.y);
+			}
+		}
+		skirt = (hmax - hmin) / 4;
+		for (TerrainTile * mesh : meshes) delete mesh;
+		meshes.resize(tree.Size());
+		for (int k = 0; k < tree.Size(); k++) meshes[k] = Mesh(tree.Root() + k);
+	}
 
+	const HeightQuadtree& Tree() const { return tree; } // bounds and height ranges of the chunks
+	int Selected() const { return (int)selected.size(); } // chunks drawn in the last viewport
+
+	void Draw(RenderState state) override {
+		mat4 M, Minv;
+		SetModelingTransform(M, Minv);
+		mat4 VP = state.V * state.P;
+		vec4 cols[4];
+		for (int k = 0; k < 4; k++) cols[k] = vec4(VP[0][k], VP[1][k], VP[2][k], VP[3][k]);
+		vec4 planes[6] = { cols[3] + cols[0], cols[3] - cols[0], cols[3] + cols[1], cols[3] - cols[1], cols[3] + cols[2], cols[3] - cols[2] };
+		float K = windowHeight / 2 * state.P[1][1]; // pixels per unit of error at unit distance
+		selected.clear();
+		Select(tree.Root(), planes, state.wEye, K);
+
+		state.M = M;
+		state.Minv = Minv;
+		state.MVP = state.M * state.V * state.P;
+		state.material = material;
+		state.texture = texture;
+		shader->Bind(state);
+		for (const Node * node : selected) meshes[tree.Index(node)]->Draw();
 	}
+};
 
+//---------------------------
+struct LightBaker { // view independent terrain lighting, computed once for static terrain and lights
+//---------------------------
+	static vec3 HeightColor(float h) { // diffuse reflectance of MyShader
+		vec3 g(0.133f, 0.702f, 0.094f), b(0.549f, 0.333f, 0.11f);
+		return b * (0.25f * h + 0.5f) + g * (1 - 0.25f * h - 0.5f);
+	}
+
+	// Fraction of the sky hemisphere above the heightfield horizon, sampled in nDirs directions up to radius
+	static float AmbientOcclusion(const HeightField& field, vec3 p, float radius, int nDirs = 8, int nSteps = 12) {
+		float occlusion = 0;
+		for (int d = 0; d < nDirs; d++) {
+			float angle = 2 * (float)M_PI * d / nDirs;
+			vec2 dir(cosf(angle), sinf(angle));
+			float maxSlope = 0;
+			for (int k = 1; k <= nSteps; k++) {
+				float r = radius * k / nSteps;
+				float dh = field.Height(p.x + dir.x * r, p.z + dir.y * r) - p.y;
+				maxSlope = fmaxf(maxSlope, dh / r);
+			}
+			occlusion += maxSlope / sqrtf(1 + maxSlope * maxSlope); // sine of the horizon elevation
+		}
+		return 1 - occlusion / nDirs;
+	}
+
+	// Ambient times occlusion plus diffuse of every light into the surface's vertex colors
+	static void Bake(SurfaceMesh * mesh, Object * object, const HeightField& field, const std::vector<Light>& lights,
+	                 const Material& material, bool occlusion = true) {
+		int N = mesh->Rows(), M = mesh->Columns();
+		std::vector<ParamSurface::VertexData> grid((N + 1) * (M + 1));
+		mesh->surface->GenGrid(N, M, grid);
+		mat4 Mm, Minv;
+		object->SetModelingTransform(Mm, Minv);
+		float radius = length(vec3(Mm[0].x, Mm[0].y, Mm[0].z)) / 8;
+		std::vector<vec3> colors(grid.size());
+#pragma omp parallel for
+		for (int k = 0; k < (int)grid.size(); k++) {
+			vec4 wp = vec4(grid[k].position.x, grid[k].position.y, grid[k].position.z, 1) * Mm;
+			vec3 p(wp.x, wp.y, wp.z), n = normalize(NormalToWorld(Minv, grid[k].normal));
+			if (n.y < 0) n = -n; // the terrain is seen from above
+			float ao = occlusion ? AmbientOcclusion(field, p, radius) : 1;
+			vec3 kd = HeightColor(grid[k].position.y), radiance(0, 0, 0);
+			for (const Light& light : lights) {
+				vec3 L = normalize(vec3(light.wLightPos.x, light.wLightPos.y, light.wLightPos.z) - p * light.wLightPos.w);
+				radiance = radiance + material.ka * light.La * ao + kd * light.Le * fmaxf(dot(n, L), 0);
+			}
+			colors[k] = radiance;
+		}
+		mesh->SetVertexColors(colors);
+	}
 };
+
 //---------------------------
-class Scene {
+class Scene { // what the window draws of the world
 //---------------------------
 	std::vector<Object *> objects;
 	Camera camera; // 3D camera
 	std::vector<Light> lights;
-	Body * b;
+	BodyObject * jumper;
+	RopeObject * rope = nullptr;
+	CrowdObject * crowd = nullptr;
 public:
 	Camera c2;
+	TerrainStreamer * streamer = nullptr;
+	ClipmapTerrain * clipmap = nullptr;
+	NoiseShader * noiseShader = nullptr;
+	FrameTimer * frameTimer = nullptr;
 	void Build() {
 		// Shaders
 		
@@ -607,24 +1429,58 @@ public:
 		Texture * texture4x8 = new CheckerBoardTexture(4, 8);
 		// Geometries
 		
-		Geometry * noise = new Noise();
+		ParamSurface * noise;
+		Geometry * terrain;
+		SurfaceMesh * mesh = nullptr; // of the terrain drawn with the vertices of the surface
+		Shader * terrainShader = myshader;
+		if (gpuTerrain || animatedTerrain) {
+			Noise * coefficients = new Noise();
+			noiseShader = new NoiseShader();
+			noiseShader->SetTerms(coefficients->Terms());
+			if (animatedTerrain) noiseShader->SetDrifts(coefficients->Drifts());
+			terrainShader = noiseShader;
+			noise = coefficients;
+			terrain = new SurfaceMesh(new FlatGrid(), gpuTerrainResolution, gpuTerrainResolution);
+		} else {
+			noise = fftTerrain ? (ParamSurface *)new FFTNoise() : new Noise();
+			int n = fftTerrain ? ((FFTNoise *)noise)->Size() : tessellationLevel; // every sample of the FFT terrain
+			terrain = mesh = new SurfaceMesh(noise, n, n);
+			if (bakedLighting) terrainShader = new MyShader(bakedVertexSource, bakedFragmentSource);
+		}
 		
 		Geometry * cube = new Cube();
 		// Create objects by setting up their vertex data on the GPU
 	
-		Object * noiseObject = new Object(myshader, material0, texture4x8, noise);
-		noiseObject->translation = vec3(0, -5, 0);
-		noiseObject->scale = vec3(15, 1, 15);
-		noiseObject->rotationAxis = vec3(0, 1, 0);
-		objects.push_back(noiseObject);
+		Object * noiseObject = new Object(terrainShader, material0, texture4x8, terrain);
+		World::PlaceTerrain(*noiseObject);
+		world.Build(noise, noiseObject);
+		if (profileTerrain) frameTimer = new FrameTimer(animatedTerrain ? "animated terrain" : "static terrain");
+		if (quadtreeTerrain) {
+			TerrainQuadtree * quadtree = new TerrainQuadtree(myshader, material0);
+			quadtree->translation = noiseObject->translation;
+			quadtree->scale = noiseObject->scale;
+			quadtree->rotationAxis = noiseObject->rotationAxis;
+			quadtree->Build(noise);
+			objects.push_back(quadtree);
+		} else if (clipmapTerrain) {
+			clipmap = new ClipmapTerrain(new ClipmapShader(), material0, noise);
+			clipmap->translation = noiseObject->translation;
+			clipmap->scale = noiseObject->scale;
+			clipmap->rotationAxis = noiseObject->rotationAxis;
+			objects.push_back(clipmap);
+		} else if (streamTerrain) {
+			streamer = new TerrainStreamer(myshader, material0, noise);
+			streamer->translation = noiseObject->translation;
+			streamer->scale = noiseObject->scale;
+			streamer->rotationAxis = noiseObject->rotationAxis;
+			objects.push_back(streamer);
+		} else {
+			objects.push_back(noiseObject);
+		}
 
 
 
-		Body * cubeObject = new Body(phongShader, material0, texture4x8, cube);
-		cubeObject->translation = vec3(0, 5, 0);
-		cubeObject->scale = vec3(1, 1.5, 0.5);
-		objects.push_back(cubeObject);
-		b = cubeObject;
+		BuildBodies(phongShader, material0, texture4x8, cube);
 
 
 
@@ -640,11 +1496,29 @@ public:
 		lights[0].La = vec3(0.1f, 0.1f, 0.1f);
 		lights[0].Le = vec3(1, 1, 1);
 
-		
+		// terrain and lights do not move, so only the specular term has to be evaluated per frame
+		if (bakedLighting && mesh && !quadtreeTerrain && !clipmapTerrain && !streamTerrain)
+			LightBaker::Bake(mesh, noiseObject, world.heightField, lights, *material0);
+	}
+
+	// The simulated objects of the world: the jumper, its rope and the crowd
+	void BuildBodies(Shader * shader, Material * material, Texture * texture, Geometry * cube) {
+		jumper = new BodyObject(shader, material, texture, cube, world.Jumper());
+		objects.push_back(jumper);
+		if (world.Jumper()->rope) {
+			rope = new RopeObject(shader, material, texture);
+			objects.push_back(rope);
+		}
+		if (world.crowd) {
+			crowd = new CrowdObject(shader, material, texture, cube, world.crowd);
+			objects.push_back(crowd);
+		}
 	}
 
 	void Render() {
-		
+		if (streamer) streamer->Update({ c2.wEye, camera.wEye });
+		if (clipmap) clipmap->Update(camera.wEye);
+		if (frameTimer) frameTimer->Begin();
 		glViewport(0, 0, 300, 600);
 		
 	
@@ -661,16 +1535,32 @@ public:
 		state.P = camera.P();
 		state.lights = lights;
 		for (Object * obj : objects) obj->Draw(state);
+		if (frameTimer) frameTimer->End();
+	}
+
+	// Frames after the one showing this snapshot would all be the same: the bodies rest, so the drone following the
+	// jumper does too, the other camera does not orbit, the terrain does not drift and has no tiles on the way
+	bool Still(const SceneSnapshot& snapshot) const {
+		return snapshot.resting && !orbitCamera && !animatedTerrain && (!streamer || streamer->Complete());
 	}
 
-	void Animate(float tstart, float tend) {
-		for (Object * obj : objects) obj->Animate(tstart, tend);
-		camera.wEye = vec3(10 * sinf(tend/5), 0, 10*cosf(tend/5));
-		vec4 ll = vec4(0, -0.5, 0, 1) * b->M;
+	// Per frame at real time now: the jumper drawn between the two steps of the snapshot, cameras follow it
+	void Show(const SceneSnapshot& snapshot, double now) {
+		double t = now - snapshot.dropped; // simulated time of the frame
+		jumper->shown[0] = snapshot.prev;
+		jumper->shown[1] = snapshot.cur;
+		jumper->alpha = (float)std::min(std::max((t - snapshot.time) / physicsStep, 0.0), 1.0);
+		if (rope) rope->shown = snapshot.rope;
+		if (crowd) crowd->shown = snapshot.crowd;
+		if (animatedTerrain) noiseShader->SetTime((float)t);
+		if (orbitCamera) camera.wEye = vec3(10 * sinf((float)t/5), 0, 10*cosf((float)t/5));
+		mat4 M, Minv;
+		jumper->RenderTransform(M, Minv);
+		vec4 ll = vec4(0, -0.5, 0, 1) * M;
 		c2.wEye = vec3(ll.x, ll.y, ll.z);
-		vec4 nn = vec4(0, -1, 0, 0) * b->Minv;
+		vec4 nn = vec4(0, -1, 0, 0) * Minv;
 		c2.wLookat = c2.wEye + vec3(nn.x, nn.y, nn.z);
-		vec4 oo = vec4(1, 0, 0, 0) * b->Minv;
+		vec4 oo = vec4(1, 0, 0, 0) * Minv;
 		c2.wVup = vec3(oo.x, oo.y, oo.z);
 
 	}
@@ -683,7 +1573,18 @@ void onInitialization() {
 	glViewport(0, 0, windowWidth, windowHeight);
 	glEnable(GL_DEPTH_TEST);
 	glDisable(GL_CULL_FACE);
+	if (sessionReplay && !session.Replay(sessionReplay)) printf("cannot replay the session of %s\n", sessionReplay);
 	scene.Build();
+	if (checkNoiseGrid) Noise().CheckGrid();
+	if (benchmarkIntegrators) BenchmarkIntegrators();
+	if (benchmarkCrowd) BenchmarkCrowd();
+	if (benchmarkThreads) BenchmarkThreads();
+	if (benchmarkBroadphase) BenchmarkBroadphase();
+	if (benchmarkEvents) BenchmarkEvents();
+	if (benchmarkTunneling) BenchmarkTunneling();
+	if (benchmarkRope) BenchmarkRope();
+	if (!sessionReplay && sessionRecord && !session.Record(sessionRecord)) printf("cannot record the session to %s\n", sessionRecord);
+	if (physicsThread) physics.Start();
 }
 
 // Window has become invalid: Redraw
@@ -696,7 +1597,11 @@ void onDisplay() {
 
 // Key of ASCII code pressed
 void onKeyboard(unsigned char key, int pX, int pY) { 
-	goon = true;	
+	if (instrumentPhysics && (key == 'c' || key == 'b')) { // the instrumentation, not an input of the simulation
+		world.probe.Request(key == 'c' ? "probe.csv" : "probe.bin");
+		return;
+	}
+	pressedKey = key ? key : ' ';
 }
 
 // Key of ASCII code released
@@ -711,14 +1616,26 @@ void onMouseMotion(int pX, int pY) {
 
 // Idle event indicating that some time elapsed: do animation here
 void onIdle() {
-	static float tend = 0;
-	const float dt = 0.1f; // dt is infinitesimal
-	float tstart = tend;
-	tend = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-
-	for (float t = tstart; t < tend; t += dt) {
-		float Dt = fmin(dt, tend - t);
-		scene.Animate(t, t + Dt);
+	static bool still = false; // the frame on the screen shows the scene at rest
+	double now;
+	const SceneSnapshot * snapshot;
+	if (physicsThread) {
+		now = physics.Now();
+		snapshot = &physics.Latest();
+	} else {
+		static SimulationClock clock(physicsStep, maxStepsPerFrame);
+		static SceneSnapshot single;
+		now = session.Speed() * glutGet(GLUT_ELAPSED_TIME) / 1000.0;
+		Simulate(clock, now);
+		world.Publish(single, clock.time, clock.dropped);
+		snapshot = &single;
 	}
+	if (still && scene.Still(*snapshot)) { // nothing to redraw, wait for input instead of spinning
+		std::this_thread::sleep_for(std::chrono::duration<double>(sleepPoll));
+		return;
+	}
+	scene.Show(*snapshot, now);
+	still = scene.Still(*snapshot);
 	glutPostRedisplay();
 }
+
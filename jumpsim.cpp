@@ -0,0 +1,49 @@
+//=============================================================================================
+// Headless batch simulator of the bungee jumper: Monte-Carlo statistics of random SPACE launches.
+// Built from physics.cpp only: needs no GL headers or libraries, creates no window or OpenGL context.
+//
+// Usage: jumpsim [launches = 1000000] [D = 1] [l0 = 3] [m = 1] [seconds = 10] [threads = 0: one per core]
+//        jumpsim --replay session.jmp [probe.csv | probe.bin]
+//                                        runs a recorded session of the window as fast as possible,
+//                                        optionally with the energies and forces of the jumper per step
+//        jumpsim --check                 Noise grid and quadtree checks, nonzero exit status if one fails
+//        jumpsim --benchmark name        integrators, crowd, events, threads, broadphase, tunneling, rope or all
+//=============================================================================================
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Statistics and histograms as CSV on out, simulations per second of the batches on stderr
+void SimulateJumps(long nLaunches, float D, float l0, float m, float duration, int nThreads, FILE * out);
+
+// Speed and final state digest of the replay, nonzero if it does not match the recording
+int ReplaySession(const char * path, const char * probePath);
+
+// Checks of the physics that the window runs behind its switches, returns the number that failed
+int RunChecks();
+
+// The benchmark of that name, or every one for "all"; false if there is none of that name
+bool RunBenchmark(const char * name);
+
+// Entry point of the batch simulator
+int main(int argc, char * argv[]) {
+	if (argc > 2 && strcmp(argv[1], "--replay") == 0) return ReplaySession(argv[2], argc > 3 ? argv[3] : nullptr);
+	if (argc > 1 && strcmp(argv[1], "--check") == 0) return RunChecks() > 0;
+	if (argc > 2 && strcmp(argv[1], "--benchmark") == 0) {
+		if (RunBenchmark(argv[2])) return 0;
+		fprintf(stderr, "unknown benchmark %s\n", argv[2]);
+		return 1;
+	}
+	long launches = argc > 1 ? atol(argv[1]) : 1000000;
+	float D = argc > 2 ? (float)atof(argv[2]) : 1;
+	float l0 = argc > 3 ? (float)atof(argv[3]) : 3;
+	float m = argc > 4 ? (float)atof(argv[4]) : 1;
+	float seconds = argc > 5 ? (float)atof(argv[5]) : 10;
+	int threads = argc > 6 ? atoi(argv[6]) : 0;
+	if (launches <= 0 || D <= 0 || l0 <= 0 || m <= 0 || seconds <= 0) {
+		fprintf(stderr, "usage: %s [launches] [D] [l0] [m] [seconds] [threads] | --replay session.jmp [probe.csv] | --check | --benchmark name\n", argv[0]);
+		return 1;
+	}
+	SimulateJumps(launches, D, l0, m, seconds, threads, stdout);
+	return 0;
+}
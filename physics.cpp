@@ -0,0 +1,596 @@
+//=============================================================================================
+// Physics of the bungee jumper without OpenGL: the world stepped by the window and by jumpsim, the session log,
+// the batch simulations and the benchmarks. Compiles without the GL headers, links without framework.cpp and the
+// GL libraries.
+//=============================================================================================
+#include "physics.h"
+
+bool goon = false;
+bool instrumentPhysics = probePhysics; // also set by jumpsim --replay with a probe file
+World world;
+SessionLog session;
+std::atomic<int> pressedKey{ 0 };
+
+// Energy drift of the undamped swinging body against the number of derivative evaluations
+void BenchmarkIntegrators(float duration) {
+	const float steps[] = { 0.001f, 0.01f, 0.05f };
+	for (int scheme = ExplicitEuler; scheme <= RungeKutta45; scheme++) {
+		for (float dt : steps) {
+			Body body;
+			body.scale = vec3(1, 1.5, 0.5);
+			body.ro = body.kappa = 0;
+			body.free3D = false; // the integrators step the planar state
+			delete body.integrator;
+			body.integrator = NewIntegrator((Integration)scheme);
+			BodyState state(vec3(0, 5, 0), vec3(1.5f, 0.5f, 0));
+			float E0 = body.Energy(state), drift = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (float t = 0; t < duration; t += dt) {
+				body.integrator->Step(body, state, dt);
+				drift = fmaxf(drift, fabsf(body.Energy(state) - E0));
+			}
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			printf("%-20s dt %.3f: %8ld evaluations, %8.3f ms, max energy drift %.3e of %.3f\n",
+			       body.integrator->Name(), dt, body.integrator->evaluations, ms, drift, E0);
+		}
+	}
+}
+
+// i-th jumper of the benchmarks, launched already
+inline void BenchmarkJumper(Body& body, int i) {
+	CounterRNG rng = CounterRNG(worldSeed).Stream(CrowdStream);
+	body.translation = body.s = vec3(2.0f * (i % 100), 5, 2.0f * (i / 100));
+	body.scale = vec3(1, 1.5, 0.5);
+	body.rotationAxis = vec3(0, 0, 1);
+	body.free3D = false; // the benchmarks step the planar State, whatever rigidBody3D is
+	body.v = vec3(rng.Uniform(0.5f, 2.0f, i, 0), rng.Uniform(0.0f, 1.0f, i, 1), 0);
+}
+
+// Largest deviation of the BodySystem from Body::Animate, then throughput at growing population sizes
+void BenchmarkCrowd(int nSteps, float dt) {
+	for (Integration scheme : { ExplicitEuler, SemiImplicitEuler }) {
+		const int nCheck = 64;
+		std::vector<Body *> bodies;
+		BodySystem system;
+		system.scheme = scheme;
+		for (int i = 0; i < nCheck; i++) {
+			bodies.push_back(new Body());
+			delete bodies[i]->integrator;
+			bodies[i]->integrator = NewIntegrator(scheme);
+			BenchmarkJumper(*bodies[i], i);
+			system.Add(*bodies[i]);
+		}
+		float deviation = 0;
+		for (int step = 0; step < nSteps; step++) {
+			system.Step(dt);
+			for (Body * body : bodies) {
+				BodyState state = body->State();
+				body->integrator->Step(*body, state, dt);
+				body->SetState(state);
+			}
+		}
+		for (int i = 0; i < nCheck; i++) {
+			BodyState d = system.State(i) + bodies[i]->State() * -1;
+			deviation = fmaxf(deviation, d.MaxAbs());
+			delete bodies[i];
+		}
+		printf("BodySystem %s vs Body: max deviation %.3e after %d steps\n", scheme == ExplicitEuler ? "explicit Euler" : "semi-implicit Euler",
+		       deviation, nSteps);
+	}
+	for (int n = 1000; n <= 100000; n *= 10) {
+		Body body;
+		BodySystem system;
+		for (int i = 0; i < n; i++) {
+			BenchmarkJumper(body, i);
+			system.Add(body);
+		}
+		int steps = std::max(10, 10000000 / n);
+		auto start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++) system.Step(dt);
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		double aos = 0;
+		if (n == 1000) { // the same with Body objects for reference
+			std::vector<Body *> bodies;
+			for (int i = 0; i < n; i++) {
+				bodies.push_back(new Body());
+				BenchmarkJumper(*bodies[i], i);
+			}
+			auto start = std::chrono::steady_clock::now();
+			for (int step = 0; step < steps; step++) {
+				for (Body * b : bodies) {
+					BodyState state = b->State();
+					b->integrator->Step(*b, state, dt);
+					b->SetState(state);
+				}
+			}
+			aos = (double)n * steps / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			for (Body * b : bodies) delete b;
+		}
+		printf("BodySystem %6d bodies: %.3e bodies*steps/s", n, n * steps / sec);
+		if (aos > 0) printf(" (Body objects: %.3e)", aos);
+		printf("\n");
+	}
+	{ // free rigid bodies for reference
+		const int n = 1000, steps = 1000;
+		std::vector<Body *> bodies;
+		for (int i = 0; i < n; i++) {
+			bodies.push_back(new Body());
+			BenchmarkJumper(*bodies[i], i);
+			bodies[i]->free3D = true;
+		}
+		auto start = std::chrono::steady_clock::now();
+		for (int step = 0; step < steps; step++) for (Body * b : bodies) b->Step3D(dt);
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		printf("Body 3D      %6d bodies: %.3e bodies*steps/s\n", n, n * steps / sec);
+		for (Body * b : bodies) delete b;
+	}
+}
+
+// A 10 s jump with RK4 in fixed steps and with the event-driven stepper: derivative evaluations, the error
+// of the first taut moment against its closed form root, and the final distance from a 0.1 ms reference
+void BenchmarkEvents(float duration) {
+	auto jump = [duration](Body& body, bool events, float frame, float& tautError) {
+		BenchmarkJumper(body, 0);
+		delete body.integrator;
+		body.integrator = new RK4Integrator();
+		body.maxLoadedStep = frame;
+		BodyState state = body.State();
+		float tautTime = body.TautTime(state, duration); // the start is slack
+		tautError = 0;
+		long steps = lroundf(duration / frame);
+		for (long i = 0; i < steps; i++) {
+			float t = i * frame;
+			if (events) {
+				if (t < tautTime && t + frame >= tautTime) tautError = fabsf(body.Stretch(body.FreeFlight(state, tautTime - t)));
+				body.Advance(state, frame);
+			} else {
+				bool slack = body.Stretch(state) <= 0;
+				body.integrator->Step(body, state, frame);
+				if (slack && tautError == 0 && body.Stretch(state) > 0) tautError = body.Stretch(state); // overshoot
+			}
+		}
+		return state;
+	};
+	Body reference;
+	float tautError;
+	BodyState exact = jump(reference, false, 0.0001f, tautError);
+	for (float frame : { 0.001f, 0.01f, 0.05f }) {
+		for (bool events : { false, true }) {
+			Body body;
+			auto start = std::chrono::steady_clock::now();
+			BodyState end = jump(body, events, frame, tautError);
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			printf("%s steps of %.3f: %6ld evaluations, %7.3f ms, stretch at the taut moment %.2e, final error %.3e\n",
+			       events ? "event-driven" : "fixed       ", frame, body.integrator->evaluations, ms, tautError,
+			       (end + exact * -1).MaxAbs());
+		}
+	}
+}
+
+// Throughput of the crowd stepped on 1, 2, 4 .. maxThreads threads, and whether the results are bitwise equal
+void BenchmarkThreads(int maxThreads, float dt) {
+	std::vector<int> threadCounts;
+	for (int t = 1; t < maxThreads; t *= 2) threadCounts.push_back(t);
+	threadCounts.push_back(maxThreads);
+	for (int n = 1000; n <= 1000000; n *= 10) {
+		std::vector<BodyState> reference;
+		double base = 0;
+		for (int threads : threadCounts) {
+			Body body;
+			BodySystem system;
+			for (int i = 0; i < n; i++) {
+				BenchmarkJumper(body, i);
+				system.Add(body);
+			}
+			StepPool pool(threads);
+			system.pool = &pool;
+			int steps = std::max(10, 20000000 / n);
+			auto start = std::chrono::steady_clock::now();
+			for (int step = 0; step < steps; step++) system.Step(dt);
+			double rate = (double)n * steps / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			bool identical = true;
+			for (int i = 0; i < n; i++) {
+				if (threads == 1) reference.push_back(system.State(i));
+				else identical = identical && (system.State(i) + reference[i] * -1).MaxAbs() == 0;
+			}
+			if (threads == 1) base = rate;
+			printf("%7d bodies, %2d threads: %.3e bodies*steps/s, speedup %5.2f, %s\n", n, threads, rate, rate / base,
+			       identical ? "identical" : "DIFFERENT");
+		}
+	}
+}
+
+// Contact search of the crowd with the spatial hash on 1 and on all threads, against testing all the pairs,
+// for jumpers scattered at a constant density; the contacts found must be the same
+void BenchmarkBroadphase(int maxThreads) {
+	CounterRNG rng = CounterRNG(worldSeed).Stream(CrowdStream);
+	for (int n = 1000; n <= 100000; n *= 10) {
+		Body jumper;
+		jumper.scale = vec3(0.2f, 0.3f, 0.1f);
+		jumper.free3D = false; // placed by rotationAngle
+		BodySystem system;
+		float side = 0.3f * cbrtf((float)n); // a (0.3 m)^3 cell per jumper
+		for (int i = 0; i < n; i++) {
+			jumper.translation = vec3(rng.Uniform(0, side, i, 0), rng.Uniform(0, side, i, 1), rng.Uniform(0, side, i, 2));
+			jumper.rotationAngle = rng.Uniform(0, 2 * (float)M_PI, i, 3);
+			system.Add(jumper);
+		}
+		auto time = [&system](int repeats, const std::function<int()>& search, int& found) {
+			auto start = std::chrono::steady_clock::now();
+			for (int r = 0; r < repeats; r++) found = search();
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / repeats;
+		};
+		auto pairs = [&system] { // sorted by the bodies
+			std::vector<std::pair<int, int>> p;
+			for (const auto& c : system.contacts) p.push_back(std::make_pair(c.a, c.b));
+			std::sort(p.begin(), p.end());
+			return p;
+		};
+		int repeats = std::max(1, 100000 / n), found, threaded, all = -1;
+		double one = time(repeats, [&system] { return system.FindContacts(); }, found);
+		std::vector<std::pair<int, int>> hashed = pairs();
+		StepPool pool(maxThreads);
+		system.pool = &pool;
+		double many = time(repeats, [&system] { return system.FindContacts(); }, threaded);
+		bool same = pairs() == hashed;
+		double brute = n <= 10000 ? time(1, [&system] { return system.FindContactsBruteForce(); }, all) : 0;
+		if (all >= 0) same = same && pairs() == hashed;
+		printf("%6d jumpers: %6d contacts, spatial hash %8.3f ms, on %d threads %8.3f ms", n, found, one, maxThreads, many);
+		if (all >= 0) printf(", all pairs %9.3f ms", brute);
+		printf(" (%s)\n", same ? "same contacts" : "DIFFERENT contacts");
+	}
+}
+
+// Fast boxes at large steps, counted when they pass through what they were thrown at: jumpers sliding into a thin
+// ridge of flat ground (their center crosses the ground in a step, jumping over is fine), and pairs of the crowd
+// flying head-on at each other (they swap sides); without and with the sweeps
+void BenchmarkTunneling(float duration) {
+	struct Ridge : public ParamSurface { // 30 x 30 ground with a ridge along z at x = 0, 1.2 high and half a meter wide
+		void eval(Dnum2 &U, Dnum2 &V, Dnum2 &X, Dnum2 &Y, Dnum2 &Z) override {
+			X = U - 0.5;
+			Z = V - 0.5;
+			Dnum2 r = X * 120;
+			Y = Exp(Dnum2(0) - r * r) * 1.2f;
+		}
+	} ridge;
+	Placement ground;
+	ground.scale = vec3(30, 1, 30);
+	ground.rotationAxis = vec3(0, 1, 0);
+	HeightField field;
+	field.Build(&ridge, &ground);
+	const float speeds[] = { 5, 10, 20, 40 };
+	const int nThrows = 8; // per speed
+	bool going = goon;
+	goon = true;
+	for (float dt : { 0.01f, 0.05f, 0.1f }) {
+		for (bool continuous : { false, true }) {
+			TerrainCollider collider;
+			collider.continuous = continuous;
+			BodySystem crowd;
+			crowd.continuous = continuous;
+			int tunneled = 0, crossed = 0;
+			long steps = lroundf(duration / dt), nSteps = 0;
+			auto start = std::chrono::steady_clock::now();
+			for (float speed : speeds) {
+				for (int k = 0; k < nThrows; k++) {
+					Body body;
+					body.scale = vec3(1, 1.5f, 0.5f);
+					body.D = 0;
+					body.translation = vec3(-3, 0.8f + 0.05f * k, 0); // 5 to 40 cm above the ground
+					body.v = vec3(speed, 0, 0);
+					bool through = false;
+					for (long i = 0; i < steps; i++, nSteps++) {
+						vec3 from = body.translation;
+						body.Animate(i * dt, (i + 1) * dt);
+						collider.Collide(body, field, dt);
+						float t, move = length(body.translation - from);
+						if (move > 0 && field.Intersect(from, body.translation - from, t, move)) through = true;
+					}
+					if (through) tunneled++;
+
+					Body pair;
+					pair.scale = body.scale;
+					pair.D = 0;
+					pair.g = vec3(0, 0, 0);
+					int row = crowd.Size(); // 2 m apart along z
+					pair.translation = vec3(-2, 0, (float)row);
+					pair.v = vec3(speed / 2, 0, 0);
+					crowd.Add(pair);
+					pair.translation = vec3(2, 0.05f * k, (float)row);
+					pair.v = vec3(-speed / 2, 0, 0);
+					crowd.Add(pair);
+				}
+			}
+			double jumpers = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			for (long i = 0; i < steps; i++) {
+				crowd.Step(dt);
+				crowd.Collide();
+			}
+			for (int i = 0; i < crowd.Size(); i += 2) if (crowd.State(i).x.x > crowd.State(i + 1).x.x) crossed++;
+			printf("%s steps of %.2f s: %2d of %d jumpers through the ridge (%5.2f us and %5.1f height queries per step), "
+			       "%2d of %d pairs through each other\n", continuous ? "swept   " : "discrete", dt, tunneled, nThrows * 4,
+			       jumpers / nSteps, (double)collider.queries / nSteps, crossed, crowd.Size() / 2);
+		}
+	}
+	goon = going;
+}
+
+// Peak stretch of the XPBD rope when the jumper drops from its rest length, at growing segment counts with the
+// default iterations and with enough of them to converge, against 2mg/k of the massless spring the rope approaches
+void BenchmarkRope(float duration) {
+	const float dt = 0.001f;
+	auto drop = [duration, dt](int nSegments, int iterations, double& us) {
+		Body body;
+		body.scale = vec3(1, 1.5f, 0.5f);
+		body.ro = body.kappa = 0;
+		body.translation = vec3(0, body.s.y - body.l0 + body.scale.y / 2, 0); // the rope hangs straight, just taut
+		body.v = vec3(0, 0, 0);
+		body.Settle();
+		body.rope = new Rope(body.s, body.AttachmentPoint(), body.l0, nSegments, body.D * body.l0, 0.1f, iterations);
+		float peak = 0;
+		long steps = lroundf(duration / dt);
+		auto start = std::chrono::steady_clock::now();
+		for (long i = 0; i < steps; i++) {
+			body.Animate(i * dt, (i + 1) * dt);
+			peak = fmaxf(peak, body.rope->Extension());
+		}
+		us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / steps;
+		return peak;
+	};
+	bool going = goon;
+	goon = true;
+	Body body;
+	printf("massless spring: peak stretch 2mg/k = %.4f m\n", 2 * body.m * length(body.g) / (body.D * body.l0));
+	for (int n : { 5, 20, 50, 100, 200, 400 }) {
+		double us, usConverged;
+		float peak = drop(n, 0, us), converged = drop(n, 2 * n, usConverged);
+		printf("%3d segments: peak stretch %.4f m with %2d iterations (%5.1f us per step), %.4f m converged, error %5.2f%%\n",
+		       n, peak, std::max(20, n / 10), us, converged, 100 * (peak / converged - 1));
+	}
+	goon = going;
+}
+
+// Checks of what the window only tests behind its switches: the fast Noise grid against the Dnum path, and the
+// height ranges of the quadtree against the height field of the same terrain at random points of it
+int RunChecks() {
+	int failed = 0;
+	Noise noise;
+	if (!noise.CheckGrid()) failed++;
+
+	Placement terrain;
+	World::PlaceTerrain(terrain);
+	mat4 M, Minv;
+	terrain.SetModelingTransform(M, Minv);
+	HeightField field;
+	field.Build(&noise, &terrain);
+	HeightQuadtree tree;
+	tree.Build(&noise, &terrain);
+	CounterRNG rng = CounterRNG(worldSeed).Stream(27);
+	const int nPoints = 10000;
+	int outside = 0;
+	for (int k = 0; k < nPoints; k++) {
+		vec4 p = vec4(rng.Uniform(k, 0) - 0.5f, 0, rng.Uniform(k, 1) - 0.5f, 1) * M;
+		float h = field.Height(p.x, p.z), hmin, hmax, tolerance = 1e-4f * (1 + fabsf(h));
+		if (!tree.HeightRange(p.x, p.z, p.x, p.z, hmin, hmax) || h < hmin - tolerance || h > hmax + tolerance) outside++;
+	}
+	printf("Quadtree height ranges %s the height field at %d of %d points\n", outside ? "miss" : "bound", outside ? outside : nPoints, nPoints);
+	if (outside) failed++;
+	return failed;
+}
+
+// Runs the benchmark called name, every one for "all"; false if there is none of that name
+bool RunBenchmark(const char * name) {
+	const struct { const char * name; void (*run)(); } benchmarks[] = {
+		{ "integrators", [] { BenchmarkIntegrators(); } }, { "crowd", [] { BenchmarkCrowd(); } },
+		{ "events", [] { BenchmarkEvents(); } }, { "threads", [] { BenchmarkThreads(); } },
+		{ "broadphase", [] { BenchmarkBroadphase(); } }, { "tunneling", [] { BenchmarkTunneling(); } },
+		{ "rope", [] { BenchmarkRope(); } },
+	};
+	bool all = strcmp(name, "all") == 0, found = false;
+	for (const auto& benchmark : benchmarks) {
+		if (!all && strcmp(name, benchmark.name) != 0) continue;
+		if (all) printf("--- %s\n", benchmark.name);
+		benchmark.run();
+		found = true;
+	}
+	return found;
+}
+
+//---------------------------
+struct JumpStats { // running moments and a histogram of one quantity over many jumps
+//---------------------------
+	static const int nBins = 256;
+	const char * name;
+	float lo, hi;          // histogram range, the outer bins also count what falls outside
+	long n = 0;
+	double sum = 0, sum2 = 0, min = 1e30, max = -1e30;
+	long bins[nBins] = { };
+
+	JumpStats(const char * _name = "", float _lo = 0, float _hi = 1) : name(_name), lo(_lo), hi(_hi) { }
+
+	void Add(float x) {
+		n++;
+		sum += x;
+		sum2 += (double)x * x;
+		min = std::min(min, (double)x);
+		max = std::max(max, (double)x);
+		int bin = (int)floorf((x - lo) / (hi - lo) * nBins);
+		bins[bin < 0 ? 0 : (bin >= nBins ? nBins - 1 : bin)]++;
+	}
+
+	void Merge(const JumpStats& other) {
+		n += other.n;
+		sum += other.sum;
+		sum2 += other.sum2;
+		min = std::min(min, other.min);
+		max = std::max(max, other.max);
+		for (int k = 0; k < nBins; k++) bins[k] += other.bins[k];
+	}
+
+	float Edge(int k) const { return lo + (hi - lo) * k / nBins; }
+
+	float Quantile(double q) const { // interpolated within the histogram bin
+		double target = q * n, below = 0;
+		for (int k = 0; k < nBins; k++) {
+			if (below + bins[k] >= target && bins[k] > 0) {
+				float x = Edge(k) + (Edge(k + 1) - Edge(k)) * (float)((target - below) / bins[k]);
+				return std::min(std::max(x, (float)min), (float)max);
+			}
+			below += bins[k];
+		}
+		return (float)max;
+	}
+};
+
+// Lowest point, peak rope tension and least ground clearance of the jump-th SPACE launch of the spring jumper,
+// stepped by Body::Animate like the window does but without colliding, so a negative clearance is an impact
+inline void SimulateJump(const HeightField& field, float slope, float D, float l0, float m, float duration, uint64_t jump,
+                         JumpStats& lowest, JumpStats& tension, JumpStats& clearance) {
+	Body body;
+	body.translation = vec3(0, 5, 0);
+	body.scale = vec3(1, 1.5, 0.5);
+	body.D = D;
+	body.l0 = l0;
+	body.m = m;
+	body.Launch(CounterRNG(worldSeed).Stream(JumpStream), jump);
+	float low = 1e30f, peak = 0, clear = 1e30f;
+	// The lowest corner and the corner clearance were last seen lowMargin and clearMargin above low and clear. No corner
+	// moves more than the center plus radius times the turn in a step, the clearance changes (1 + slope) times that.
+	float radius = length(body.scale) / 2, lowMargin = 0, clearMargin = 0;
+	long steps = lroundf(duration / physicsStep);
+	for (long i = 0; i < steps; i++) {
+		body.Animate(i * physicsStep, (i + 1) * physicsStep);
+		float stretch = body.Stretch(body.State());
+		if (stretch > 0) peak = fmaxf(peak, D * (l0 + stretch) * stretch); // |K| of Body::Derivative
+		float turn = body.free3D ? length(body.w) * physicsStep : fabsf(body.rotationAngle - body.prevRotationAngle);
+		float move = length(body.translation - body.prevTranslation) + radius * turn;
+		lowMargin -= move;
+		clearMargin -= move * (1 + slope);
+		if (lowMargin > 0 && clearMargin > 0) continue; // neither can change, skip the transform
+		mat4 M, Minv;
+		body.SetModelingTransform(M, Minv);
+		float bottom = M[3].y - (fabsf(M[0].y) + fabsf(M[1].y) + fabsf(M[2].y)) / 2; // lowest corner
+		low = fminf(low, bottom);
+		lowMargin = bottom - low;
+		if (clearMargin > 0) continue;
+		float least = 1e30f;
+		for (int k = 0; k < 8; k++) {
+			vec4 c = vec4((k & 1) - 0.5f, ((k >> 1) & 1) - 0.5f, ((k >> 2) & 1) - 0.5f, 1) * M;
+			least = fminf(least, c.y - field.Height(c.x, c.z));
+		}
+		clear = fminf(clear, least);
+		clearMargin = least - clear;
+	}
+	lowest.Add(low);
+	tension.Add(peak);
+	clearance.Add(clear);
+}
+
+// Monte-Carlo safety envelope of the jumper with rope stiffness D, rest length l0 and mass m over launches
+// [0, nLaunches) of the SPACE key, on the terrain of the window. Batches report their simulations per second
+// on stderr; the merged statistics and histograms go to out as CSV. The result does not depend on nThreads.
+void SimulateJumps(long nLaunches, float D, float l0, float m, float duration, int nThreads, FILE * out) {
+	goon = true;
+	Noise noise;
+	Placement terrain;
+	World::PlaceTerrain(terrain);
+	HeightField field;
+	field.Build(&noise, &terrain);
+	float slope = field.MaxSlope();
+
+	StepPool pool(nThreads > 0 ? nThreads : std::thread::hardware_concurrency());
+	const long chunkSize = 256, batchSize = 1 << 16, nPilot = 1024;
+	auto run = [&](long first, long count, JumpStats into[3]) { // merged in chunk order, rounds the same on any number of threads
+		int nChunks = (int)((count + chunkSize - 1) / chunkSize);
+		std::vector<JumpStats> partial(3 * nChunks);
+		for (int c = 0; c < nChunks; c++)
+			for (int q = 0; q < 3; q++) partial[3 * c + q] = JumpStats(into[q].name, into[q].lo, into[q].hi);
+		pool.Run(nChunks, [&](int c) {
+			long end = std::min(first + (c + 1) * chunkSize, first + count);
+			for (long jump = first + c * chunkSize; jump < end; jump++)
+				SimulateJump(field, slope, D, l0, m, duration, (uint64_t)jump, partial[3 * c], partial[3 * c + 1], partial[3 * c + 2]);
+		});
+		for (int c = 0; c < nChunks; c++)
+			for (int q = 0; q < 3; q++) into[q].Merge(partial[3 * c + q]);
+	};
+
+	// histogram ranges: the span of the first launches, widened by that span on both sides
+	JumpStats total[3] = { JumpStats("lowest_point"), JumpStats("peak_tension"), JumpStats("ground_clearance") };
+	JumpStats pilot[3] = { total[0], total[1], total[2] };
+	run(0, std::min(nPilot, nLaunches), pilot);
+	for (int q = 0; q < 3; q++) {
+		float span = fmaxf((float)(pilot[q].max - pilot[q].min), 1e-3f * (1 + fabsf((float)pilot[q].max)));
+		total[q] = JumpStats(total[q].name, (float)pilot[q].min - span, (float)pilot[q].max + span);
+	}
+
+	auto start = std::chrono::steady_clock::now();
+	for (long first = 0; first < nLaunches; first += batchSize) {
+		long count = std::min(batchSize, nLaunches - first);
+		auto batchStart = std::chrono::steady_clock::now();
+		run(first, count, total);
+		double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+		fprintf(stderr, "%ld / %ld jumps, %.0f simulations/s\n", first + count, nLaunches, count / sec);
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	fprintf(out, "quantity,jumps,mean,stddev,min,p01,p50,p99,max\n");
+	for (const JumpStats& q : total) {
+		double mean = q.sum / q.n, var = std::max(q.sum2 / q.n - mean * mean, 0.0);
+		fprintf(out, "%s,%ld,%g,%g,%g,%g,%g,%g,%g\n", q.name, q.n, mean, sqrt(var), q.min,
+		        q.Quantile(0.01), q.Quantile(0.5), q.Quantile(0.99), q.max);
+	}
+	fprintf(out, "simulations_per_second,%ld,%g,,,,,,\n", nLaunches, nLaunches / sec);
+	fprintf(out, "\nquantity,bin_lo,bin_hi,jumps\n");
+	for (const JumpStats& q : total)
+		for (int k = 0; k < JumpStats::nBins; k++)
+			fprintf(out, "%s,%s,%s,%ld\n", q.name, k == 0 ? "-inf" : std::to_string(q.Edge(k)).c_str(),
+			        k == JumpStats::nBins - 1 ? "inf" : std::to_string(q.Edge(k + 1)).c_str(), q.bins[k]);
+}
+
+// Steps of the world due at real time now, the jumper leaves the platform at the first key press and is launched
+// again by the first one after every body fell asleep
+int Simulate(SimulationClock& clock, double now) {
+	int steps = clock.Steps(now);
+	for (int i = 0; i < steps; i++) {
+		int presses = session.Input(clock.steps, pressedKey.exchange(0));
+		if (presses < 0) return i; // end of the replay
+		if (presses > 0 && (!goon || world.Resting())) {
+			world.Launch();
+			goon = true;
+		}
+		world.Animate((float)clock.time, (float)(clock.time + clock.dt));
+		clock.Step();
+	}
+	if (instrumentPhysics) world.probe.Serve();
+	return steps;
+}
+
+// Runs the session log at path as fast as possible without a window, prints the speed and whether the final
+// state matches the recorded one; for triage and for performance regression runs on identical workloads.
+// With probePath the last probeCapacity steps of the jumper are written there, see PhysicsProbe::Write.
+int ReplaySession(const char * path, const char * probePath) {
+	if (probePath) instrumentPhysics = true;
+	if (!session.Replay(path)) return 1;
+	world.Build();
+	SimulationClock clock(physicsStep, 1 << 30);
+	double tail = -1; // a log cut short runs 10 s past its last event
+	auto start = std::chrono::steady_clock::now();
+	while (!session.Over()) {
+		if (session.Exhausted()) {
+			if (tail < 0) tail = clock.time + 10;
+			else if (clock.time >= tail) break;
+		}
+		Simulate(clock, clock.last + 1); // a simulated second per call
+	}
+	double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	printf("replayed %ld steps (%.1f s simulated) in %.3f s, %.0f steps/s, digest %016llx\n", clock.steps, clock.time, sec,
+	       clock.steps / sec, (unsigned long long)world.Digest());
+	if (probePath) {
+		world.probe.Request(probePath);
+		world.probe.Serve();
+	}
+	return session.Over() && world.Digest() != session.RecordedDigest() ? 2 : 0;
+}
+
+// Last, so that it stops before the world and the session it uses are destroyed
+PhysicsThread physics;
@@ -0,0 +1,2543 @@
+//=============================================================================================
+// Physics of the bungee jumper without OpenGL: the terrain surfaces and height field, the jumper, its rope and
+// the crowd, the session log and the thread stepping them. Shared by the window and the batch simulator jumpsim.
+//=============================================================================================
+#pragma once
+#include "vecmath.h"
+#include <stdio.h>
+#include <vector>
+#include <string>
+#include <cstdlib>
+#include <math.h>
+#include <cstdint>
+#include <cstring>
+#include <complex>
+#include <algorithm>
+#include <unordered_map>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <chrono>
+
+//---------------------------
+template<class T> struct Dnum { // Dual numbers for automatic derivation
+//---------------------------
+	float f; // function value
+	T d;  // derivatives
+	Dnum(float f0 = 0, T d0 = T(0)) { f = f0, d = d0; }
+	Dnum operator+(Dnum r) { return Dnum(f + r.f, d + r.d); }
+	Dnum operator-(Dnum r) { return Dnum(f - r.f, d - r.d); }
+	Dnum operator*(Dnum r) {
+		return Dnum(f * r.f, f * r.d + d * r.f);
+	}
+	Dnum operator/(Dnum r) {
+		return Dnum(f / r.f, (r.f * d - r.d * f) / r.f / r.f);
+	}
+};
+
+// Elementary functions prepared for the chain rule as well
+template<class T> Dnum<T> Exp(Dnum<T> g) { return Dnum<T>(expf(g.f), expf(g.f)*g.d); }
+template<class T> Dnum<T> Sin(Dnum<T> g) { return  Dnum<T>(sinf(g.f), cosf(g.f)*g.d); }
+template<class T> Dnum<T> Cos(Dnum<T>  g) { return  Dnum<T>(cosf(g.f), -sinf(g.f)*g.d); }
+template<class T> Dnum<T> Tan(Dnum<T>  g) { return Sin(g) / Cos(g); }
+template<class T> Dnum<T> Sinh(Dnum<T> g) { return  Dnum<T>(sinh(g.f), cosh(g.f)*g.d); }
+template<class T> Dnum<T> Cosh(Dnum<T> g) { return  Dnum<T>(cosh(g.f), sinh(g.f)*g.d); }
+template<class T> Dnum<T> Tanh(Dnum<T> g) { return Sinh(g) / Cosh(g); }
+template<class T> Dnum<T> Log(Dnum<T> g) { return  Dnum<T>(logf(g.f), g.d / g.f); }
+template<class T> Dnum<T> Pow(Dnum<T> g, float n) {
+	return  Dnum<T>(powf(g.f, n), n * powf(g.f, n - 1) * g.d);
+}
+
+typedef Dnum<vec2> Dnum2;
+
+//---------------------------
+struct CounterRNG { // stateless random numbers: (seed, i, j) gives the same value on every thread and node
+//---------------------------
+	uint64_t seed;
+
+	CounterRNG(uint64_t _seed = 0) : seed(_seed) { }
+
+	static uint64_t SplitMix(uint64_t x) { // SplitMix64 finalizer
+		x += 0x9E3779B97F4A7C15ull;
+		x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+		x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+		return x ^ (x >> 31);
+	}
+
+	CounterRNG Stream(uint64_t id) const { return CounterRNG(SplitMix(seed ^ SplitMix(id))); } // independent subsystem
+	uint64_t Bits(uint64_t i, uint64_t j = 0) const { return SplitMix(SplitMix(seed ^ SplitMix(i)) ^ j); }
+	float Uniform(uint64_t i, uint64_t j = 0) const { return (float)(Bits(i, j) >> 40) / 16777216.0f; } // [0, 1)
+	float Uniform(float lo, float hi, uint64_t i, uint64_t j = 0) const { return lo + (hi - lo) * Uniform(i, j); }
+};
+
+const uint64_t worldSeed = 2020;
+enum RandomStream { TerrainStream, JumpStream, CrowdStream }; // CounterRNG streams of the subsystems
+enum Integration { ExplicitEuler, SemiImplicitEuler, VelocityVerlet, RungeKutta4, RungeKutta45 };
+
+const int tessellationLevel = 20;
+const bool fftTerrain = false; // many-frequency 1/f terrain synthesized by inverse FFT instead of Noise
+const bool streamTerrain = false; // endless terrain from tiles generated around the cameras (the FFT terrain repeats every unit of u, v)
+const bool animatedTerrain = false; // phases drift with time, evaluated on the GPU like gpuTerrain; the physics keeps the t = 0 height field
+const bool eventDrivenRope = false; // slack phases of the spring rope in closed form up to the exact taut time
+const float physicsStep = 0.001f; // fixed simulation step in seconds
+const int maxStepsPerFrame = 250; // simulated time is dropped beyond this to let slow frames catch up
+const Integration bodyIntegrator = ExplicitEuler; // scheme of Body::Animate
+const int crowdSize = 0; // jumpers of a BodySystem around the single Body
+const int physicsThreads = 0; // threads stepping the crowd, 0: one per core
+const bool crowdCollisions = true; // jumpers of the crowd push each other apart, spatial hash broadphase and box tests
+const int ropeSegments = 0; // bungee as a chain of XPBD particles instead of the massless spring when positive
+const bool rigidBody3D = false; // Body with inertia tensor and quaternion orientation instead of the fixed axis
+const bool terrainCollision = false; // the jumper bounces and slides on the cached height field of the terrain
+const bool continuousCollision = true; // boxes swept over the step stop at the time of impact, no tunneling at large steps
+const float replaySpeed = 8; // simulated seconds per real second while replaying in the window
+const bool sleepAtRest = true; // bodies slower than sleepSpeed for sleepTime are not stepped, no frames while all sleep
+const float sleepSpeed = 0.05f; // m/s, and rad/s for the spin
+const float sleepTime = 1; // settle window in seconds
+const float sleepPoll = 0.02f; // seconds between looks for input while the whole scene sleeps
+const bool probePhysics = false; // energies and forces of the jumper per step into a ring, keys c and b write it out
+extern bool instrumentPhysics; // probePhysics, or set by jumpsim --replay with a probe file
+const int probeCapacity = 1 << 16; // steps kept by the instrumentation
+
+//---------------------------
+class ParamSurface { // (u, v) of the unit square to a point of the surface with its derivatives, drawn through SurfaceMesh
+//---------------------------
+public:
+	struct VertexData {
+		vec3 position, normal;
+		vec2 texcoord;
+	};
+
+	virtual void eval(Dnum2& U, Dnum2& V, Dnum2& X, Dnum2& Y, Dnum2& Z) = 0;
+
+	VertexData GenVertexData(float u, float v) {
+		VertexData vtxData;
+		vtxData.texcoord = vec2(u, v);
+		Dnum2 X, Y, Z;
+		Dnum2 U(u, vec2(1, 0)), V(v, vec2(0, 1));
+		eval(U, V, X, Y, Z);
+		vtxData.position = vec3(X.f, Y.f, Z.f);
+		vec3 drdU(X.d.x, Y.d.x, Z.d.x), drdV(X.d.y, Y.d.y, Z.d.y);
+		vtxData.normal = cross(drdU, drdV);
+		return vtxData;
+	}
+
+	// (N+1) x (M+1) samples of the [uv0, uv1] parameter rectangle, row major; surfaces with a cheaper grid evaluation override it
+	virtual void GenGrid(int N, int M, std::vector<VertexData>& grid, vec2 uv0 = vec2(0, 0), vec2 uv1 = vec2(1, 1)) {
+		for (int i = 0; i <= N; i++)
+			for (int j = 0; j <= M; j++)
+				grid[i * (M + 1) + j] = GenVertexData(uv0.x + (uv1.x - uv0.x) * j / M, uv0.y + (uv1.y - uv0.y) * i / N);
+	}
+
+	virtual ~ParamSurface() { }
+};
+
+class Noise : public ParamSurface {
+	constexpr  static int n = 3;
+	Dnum2 A[n][n];
+	Dnum2 B[n][n];
+	float drift[n][n];            // phase velocity of the animated surface, B(t) = B + drift t
+	float fx[n], fz[n];           // spatial frequency of term (i, j) along x and z: i and j, detuned for the endless terrain
+	float time = 0;
+	float cosB[n][n], sinB[n][n]; // phase rotations at time for the separable grid evaluation
+public:
+	Noise(CounterRNG rng = CounterRNG(worldSeed).Stream(TerrainStream)) {
+		initA(rng); 
+	}
+
+	// (i, j, A, B) of the nonzero terms, for NoiseShader
+	std::vector<vec4> Terms() {
+		std::vector<vec4> terms;
+		for (int i = 0; i < n; i++)
+			for (int j = 0; j < n; j++)
+				if (A[i][j].f != 0) terms.push_back(vec4(fx[i], fz[j], A[i][j].f, B[i][j].f));
+		return terms;
+	}
+
+	std::vector<float> Drifts() { // in the order of Terms
+		std::vector<float> drifts;
+		for (int i = 0; i < n; i++)
+			for (int j = 0; j < n; j++)
+				if (A[i][j].f != 0) drifts.push_back(drift[i][j]);
+		return drifts;
+	}
+
+	// Moves the phases to time t; only evaluation on the CPU needs it, the GPU path takes the time as a uniform
+	void SetTime(float t) {
+		time = t;
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++) {
+				cosB[i][j] = cosf(2 * (float)M_PI * (B[i][j].f + drift[i][j] * time));
+				sinB[i][j] = sinf(2 * (float)M_PI * (B[i][j].f + drift[i][j] * time));
+			}
+		}
+	}
+
+	void initA(CounterRNG rng) {
+		// integer frequencies repeat the surface with period 1 in (u, v); streamed tiles reach beyond it, so there
+		// they are detuned to incommensurate values and the endless terrain never repeats
+		for (int i = 0; i < n; i++) {
+			fx[i] = fz[i] = (float)i;
+			if (streamTerrain && i > 0) {
+				fx[i] += rng.Stream(2).Uniform(-0.25f, 0.25f, i, 0);
+				fz[i] += rng.Stream(2).Uniform(-0.25f, 0.25f, i, 1);
+			}
+		}
+		for(int i = 0; i < n; i++) {
+			for(int j = 0; j < n; j++) {
+				if (i == 0 && j == 0) {
+					A[i][j] = 0;
+				}else {
+					A[i][j] = (1/sqrtf(i*i + j*j));
+					B[i][j] = rng.Uniform(i, j);
+				}
+				// waves travel in random directions, faster for longer waves like on deep water
+				drift[i][j] = 0.1f * sqrtf(sqrtf((float)(i * i + j * j))) * (rng.Stream(1).Uniform(i, j) < 0.5f ? -1 : 1);
+			}
+		}
+		SetTime(time);
+	}
+
+	void eval(Dnum2 &U, Dnum2 &V, Dnum2 &X, Dnum2 &Y, Dnum2 &Z) override {
+		X = U-0.5;
+		Z = V-0.5;
+		Y = 0;
+		for(int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++) {
+				Y = Y + Cos((X * fx[i] + Z * fz[j] + B[i][j] + drift[i][j] * time) * M_PI * 2) * A[i][j];	
+			}
+		}
+	}
+
+	// Same sum as eval, split with cos(a + b) = cos a cos b - sin a sin b into a = 2pi fx[i] x (per column)
+	// and b = 2pi (fz[j] z + B[i][j]) (per row), so the trig calls are O(n) per grid line and vertices cost O(n)
+	void GenGrid(int N, int M, std::vector<VertexData>& grid, vec2 uv0 = vec2(0, 0), vec2 uv1 = vec2(1, 1)) override {
+		const float twoPi = 2 * (float)M_PI;
+		std::vector<float> ca((M + 1) * n), sa((M + 1) * n); // cos, sin(2pi fx[i] x) for every column
+		for (int c = 0; c <= M; c++) {
+			float x = uv0.x + (uv1.x - uv0.x) * c / M - 0.5f;
+			for (int i = 0; i < n; i++) {
+				ca[c * n + i] = cosf(twoPi * fx[i] * x);
+				sa[c * n + i] = sinf(twoPi * fx[i] * x);
+			}
+		}
+		for (int r = 0; r <= N; r++) {
+			float z = uv0.y + (uv1.y - uv0.y) * r / N - 0.5f;
+			float cz[n], sz[n];  // cos, sin(2pi fz[j] z) of this row
+			for (int j = 0; j < n; j++) { cz[j] = cosf(twoPi * fz[j] * z); sz[j] = sinf(twoPi * fz[j] * z); }
+			float P[n], Q[n], R[n], S[n]; // sum_j A cos b, A sin b, A fz[j] cos b, A fz[j] sin b
+			for (int i = 0; i < n; i++) {
+				P[i] = Q[i] = R[i] = S[i] = 0;
+				for (int j = 0; j < n; j++) {
+					float cb = cz[j] * cosB[i][j] - sz[j] * sinB[i][j], sb = sz[j] * cosB[i][j] + cz[j] * sinB[i][j];
+					P[i] += A[i][j].f * cb; Q[i] += A[i][j].f * sb;
+					R[i] += A[i][j].f * fz[j] * cb; S[i] += A[i][j].f * fz[j] * sb;
+				}
+			}
+			for (int c = 0; c <= M; c++) {
+				const float * cac = &ca[c * n], * sac = &sa[c * n];
+				float h = 0, hx = 0, hz = 0;
+				for (int i = 0; i < n; i++) {
+					h += cac[i] * P[i] - sac[i] * Q[i];
+					hx -= twoPi * fx[i] * (sac[i] * P[i] + cac[i] * Q[i]);
+					hz -= twoPi * (sac[i] * R[i] + cac[i] * S[i]);
+				}
+				VertexData& vtx = grid[r * (M + 1) + c];
+				vtx.texcoord = vec2(uv0.x + (uv1.x - uv0.x) * c / M, uv0.y + (uv1.y - uv0.y) * r / N);
+				vtx.position = vec3(vtx.texcoord.x - 0.5f, h, z);
+				vtx.normal = cross(vec3(1, hx, 0), vec3(0, hz, 1));
+			}
+		}
+	}
+
+	// Compares a diagonal of an N x M grid against the Dnum path, reports if the fast path drifts
+	bool CheckGrid(int N = tessellationLevel, int M = tessellationLevel) {
+		const float tolerance = 1e-3f;
+		std::vector<VertexData> grid((N + 1) * (M + 1));
+		GenGrid(N, M, grid);
+		for (int r = 0; r <= N; r++) {
+			int c = r * M / N;
+			const vec2& uv = grid[r * (M + 1) + c].texcoord;
+			VertexData ref = GenVertexData(uv.x, uv.y);
+			const VertexData& vtx = grid[r * (M + 1) + c];
+			if (fabsf(ref.position.y - vtx.position.y) > tolerance || length(ref.normal - vtx.normal) > tolerance * length(ref.normal)) {
+				printf("Noise grid evaluation differs from Dnum at (%d, %d): h %f vs %f\n", r, c, vtx.position.y, ref.position.y);
+				return false;
+			}
+		}
+		printf("Noise grid evaluation matches Dnum on %d x %d vertices\n", N, M);
+		return true;
+	}
+};	
+
+// In-place radix-2 complex FFT of n (power of two) elements spaced by stride; inverse is unnormalized
+inline void FFT(std::complex<float> * data, int n, int stride, bool inverse) {
+	for (int i = 1, j = 0; i < n; i++) { // bit reversal permutation
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) std::swap(data[i * stride], data[j * stride]);
+	}
+	for (int len = 2; len <= n; len <<= 1) {
+		float angle = 2 * (float)M_PI / len * (inverse ? 1 : -1);
+		std::complex<float> wlen(cosf(angle), sinf(angle));
+		for (int i = 0; i < n; i += len) {
+			std::complex<float> w(1, 0);
+			for (int k = 0; k < len / 2; k++) {
+				std::complex<float> a = data[(i + k) * stride], b = data[(i + k + len / 2) * stride] * w;
+				data[(i + k) * stride] = a + b;
+				data[(i + k + len / 2) * stride] = a - b;
+				w *= wlen;
+			}
+		}
+	}
+}
+
+// 2D FFT of a size x size row major grid
+inline void FFT2D(std::vector<std::complex<float>>& grid, int size, bool inverse) {
+	for (int i = 0; i < size; i++) FFT(&grid[i * size], size, 1, inverse);
+	for (int j = 0; j < size; j++) FFT(&grid[j], size, size, inverse);
+}
+
+//---------------------------
+class FFTNoise : public ParamSurface { // 1/f noise with many frequencies, synthesized on a periodic grid
+//---------------------------
+	int size, n;  // grid resolution (power of two), frequencies per axis (n <= size / 2)
+	std::vector<float> height, dhdx, dhdz; // size x size samples of the surface and its spectral derivatives
+
+	float Sample(const std::vector<float>& g, float u, float v) { // bilinear, periodic
+		float x = u * size, z = v * size;
+		int j = (int)floorf(x), i = (int)floorf(z);
+		float fx = x - j, fz = z - i;
+		auto at = [&](int i, int j) { return g[((i % size + size) % size) * size + (j % size + size) % size]; };
+		return (at(i, j) * (1 - fx) + at(i, j + 1) * fx) * (1 - fz) + (at(i + 1, j) * (1 - fx) + at(i + 1, j + 1) * fx) * fz;
+	}
+public:
+	FFTNoise(int _size = 128, int _n = 32, CounterRNG rng = CounterRNG(worldSeed).Stream(TerrainStream)) : size(_size), n(_n) {
+		initSpectrum(rng);
+	}
+
+	int Size() const { return size; } // samples per edge, a mesh of this resolution shows every one
+
+	// Same sum as Noise: Y = sum A[i][j] cos(2pi(i x + j z + B[i][j])), x = u - 0.5, z = v - 0.5, evaluated as
+	// the real part of an inverse DFT of c[i][j] = A[i][j] exp(2pi i B[i][j]); the -0.5 shift is the (-1)^(i+j) factor.
+	void initSpectrum(CounterRNG rng) {
+		std::vector<std::complex<float>> c(size * size), cx(size * size), cz(size * size);
+		for (int i = 0; i < n; i++) {
+			for (int j = 0; j < n; j++) {
+				if (i == 0 && j == 0) continue;
+				float A = 1 / sqrtf(i * i + j * j);
+				float B = rng.Uniform(i, j);
+				float phase = 2 * (float)M_PI * B + (float)M_PI * (i + j);
+				std::complex<float> cij = std::polar(A, phase);
+				int k = j * size + i; // row = z frequency, column = x frequency
+				c[k] = cij;
+				cx[k] = cij * std::complex<float>(0, 2 * (float)M_PI * i); // d/dx in the spectral domain
+				cz[k] = cij * std::complex<float>(0, 2 * (float)M_PI * j);
+			}
+		}
+		FFT2D(c, size, true);
+		FFT2D(cx, size, true);
+		FFT2D(cz, size, true);
+		height.resize(size * size); dhdx.resize(size * size); dhdz.resize(size * size);
+		for (int k = 0; k < size * size; k++) {
+			height[k] = c[k].real();
+			dhdx[k] = cx[k].real();
+			dhdz[k] = cz[k].real();
+		}
+	}
+
+	void eval(Dnum2 &U, Dnum2 &V, Dnum2 &X, Dnum2 &Y, Dnum2 &Z) override {
+		X = U - 0.5;
+		Z = V - 0.5;
+		float hx = Sample(dhdx, U.f, V.f), hz = Sample(dhdz, U.f, V.f);
+		Y = Dnum2(Sample(height, U.f, V.f), X.d * hx + Z.d * hz);
+	}
+
+	void GenGrid(int N, int M, std::vector<VertexData>& grid, vec2 uv0 = vec2(0, 0), vec2 uv1 = vec2(1, 1)) override {
+		// direct lookup when the rectangle is aligned with the FFT grid, interpolation otherwise
+		int i0 = (int)roundf(uv0.y * size), j0 = (int)roundf(uv0.x * size);
+		if (fabsf(uv0.y * size - i0) > 1e-3f || fabsf(uv0.x * size - j0) > 1e-3f ||
+			fabsf((uv1.y - uv0.y) * size - N) > 1e-3f || fabsf((uv1.x - uv0.x) * size - M) > 1e-3f) {
+			ParamSurface::GenGrid(N, M, grid, uv0, uv1);
+			return;
+		}
+		for (int i = 0; i <= N; i++) {
+			for (int j = 0; j <= M; j++) {
+				int k = ((i0 + i) % size + size) % size * size + ((j0 + j) % size + size) % size;
+				VertexData& vtx = grid[i * (M + 1) + j];
+				vtx.texcoord = vec2((float)(j0 + j) / size, (float)(i0 + i) / size);
+				vtx.position = vec3(vtx.texcoord.x - 0.5f, height[k], vtx.texcoord.y - 0.5f);
+				vtx.normal = cross(vec3(1, dhdx[k], 0), vec3(0, dhdz[k], 1));
+			}
+		}
+	}
+};
+
+//---------------------------
+struct Placement { // scale, rotation and position in the world: the modeling transform of an Object or a Body
+//---------------------------
+	vec3 scale, translation, rotationAxis;
+	float rotationAngle;
+
+	Placement() : scale(vec3(1, 1, 1)), translation(vec3(0, 0, 0)), rotationAxis(0, 0, 0), rotationAngle(0) { }
+
+	virtual void SetModelingTransform(mat4& M, mat4& Minv) {
+		M = ScaleMatrix(scale) * RotationMatrix(rotationAngle, rotationAxis) * TranslateMatrix(translation);
+		Minv = TranslateMatrix(-translation) * RotationMatrix(-rotationAngle, rotationAxis) * ScaleMatrix(vec3(1 / scale.x, 1 / scale.y, 1 / scale.z));
+	}
+
+	virtual ~Placement() { }
+};
+
+//---------------------------
+struct BodyState { // rigid body rotating around a fixed axis
+//---------------------------
+	vec3 x, v;          // position and velocity of the center
+	float angle, omega; // rotation angle and angular velocity around the axis
+
+	BodyState(vec3 _x = vec3(0, 0, 0), vec3 _v = vec3(0, 0, 0), float _angle = 0, float _omega = 0)
+		: x(_x), v(_v), angle(_angle), omega(_omega) { }
+	BodyState operator+(const BodyState& s) const { return BodyState(x + s.x, v + s.v, angle + s.angle, omega + s.omega); }
+	BodyState operator*(float a) const { return BodyState(x * a, v * a, angle * a, omega * a); }
+	float MaxAbs() const {
+		return fmaxf(fmaxf(fmaxf(fabsf(x.x), fabsf(x.y)), fmaxf(fabsf(x.z), fabsf(v.x))),
+		             fmaxf(fmaxf(fabsf(v.y), fabsf(v.z)), fmaxf(fabsf(angle), fabsf(omega))));
+	}
+};
+
+struct Dynamics { // right hand side of the equations of motion
+	// time derivative of the state: (v, a, omega, angular acceleration)
+	virtual BodyState Derivative(const BodyState& s) = 0;
+	virtual ~Dynamics() { }
+};
+
+//---------------------------
+struct Integrator { // advances a state of some dynamics by dt
+//---------------------------
+	long evaluations = 0; // of the derivative, the cost of the scheme
+	virtual const char * Name() const = 0;
+	virtual void Step(Dynamics& f, BodyState& s, float dt) = 0;
+	virtual ~Integrator() { }
+protected:
+	BodyState Eval(Dynamics& f, const BodyState& s) { evaluations++; return f.Derivative(s); }
+};
+
+struct EulerIntegrator : Integrator { // first order, gains energy
+	const char * Name() const override { return "explicit Euler"; }
+	void Step(Dynamics& f, BodyState& s, float dt) override { s = s + Eval(f, s) * dt; }
+};
+
+struct SymplecticEulerIntegrator : Integrator { // first order, velocities first, positions with the new velocities
+	const char * Name() const override { return "semi-implicit Euler"; }
+	void Step(Dynamics& f, BodyState& s, float dt) override {
+		BodyState d = Eval(f, s);
+		s.v = s.v + d.v * dt;
+		s.omega += d.omega * dt;
+		s.x = s.x + s.v * dt;
+		s.angle += s.omega * dt;
+	}
+};
+
+struct VerletIntegrator : Integrator { // second order, symplectic for position dependent forces
+	const char * Name() const override { return "velocity Verlet"; }
+	void Step(Dynamics& f, BodyState& s, float dt) override {
+		BodyState d = Eval(f, s);
+		BodyState next(s.x + s.v * dt + d.v * (dt * dt / 2), s.v + d.v * dt,
+		               s.angle + s.omega * dt + d.omega * (dt * dt / 2), s.omega + d.omega * dt);
+		BodyState dNext = Eval(f, next); // damping sees the predicted velocities
+		next.v = s.v + (d.v + dNext.v) * (dt / 2);
+		next.omega = s.omega + (d.omega + dNext.omega) * (dt / 2);
+		s = next;
+	}
+};
+
+struct RK4Integrator : Integrator { // classic fourth order Runge-Kutta
+	const char * Name() const override { return "RK4"; }
+	void Step(Dynamics& f, BodyState& s, float dt) override {
+		BodyState k1 = Eval(f, s);
+		BodyState k2 = Eval(f, s + k1 * (dt / 2));
+		BodyState k3 = Eval(f, s + k2 * (dt / 2));
+		BodyState k4 = Eval(f, s + k3 * dt);
+		s = s + (k1 + k2 * 2 + k3 * 2 + k4) * (dt / 6);
+	}
+};
+
+struct RK45Integrator : Integrator { // Dormand-Prince 5(4), substeps adapted to the error tolerance
+	float tolerance, h; // h is kept between the steps
+
+	RK45Integrator(float _tolerance = 1e-5f) : tolerance(_tolerance), h(0) { }
+	const char * Name() const override { return "adaptive RK45"; }
+
+	void Step(Dynamics& f, BodyState& s, float dt) override {
+		const float hMin = dt * 1e-4f; // substeps this short are accepted whatever the error, a step ends after 1e4 at most
+		if (h <= 0) h = dt;
+		for (double t = 0; dt - t > 1e-6 * hMin; ) { // double, so the substeps add up to dt exactly enough
+			float step = fmaxf(h, hMin);
+			if (dt - t - step < hMin) step = (float)(dt - t); // no sliver left for another substep
+			BodyState k1 = Eval(f, s);
+			BodyState k2 = Eval(f, s + k1 * (step / 5));
+			BodyState k3 = Eval(f, s + (k1 * (3.0f / 40) + k2 * (9.0f / 40)) * step);
+			BodyState k4 = Eval(f, s + (k1 * (44.0f / 45) + k2 * (-56.0f / 15) + k3 * (32.0f / 9)) * step);
+			BodyState k5 = Eval(f, s + (k1 * (19372.0f / 6561) + k2 * (-25360.0f / 2187) + k3 * (64448.0f / 6561)
+			                          + k4 * (-212.0f / 729)) * step);
+			BodyState k6 = Eval(f, s + (k1 * (9017.0f / 3168) + k2 * (-355.0f / 33) + k3 * (46732.0f / 5247)
+			                          + k4 * (49.0f / 176) + k5 * (-5103.0f / 18656)) * step);
+			BodyState next = s + (k1 * (35.0f / 384) + k3 * (500.0f / 1113) + k4 * (125.0f / 192)
+			                      + k5 * (-2187.0f / 6784) + k6 * (11.0f / 84)) * step;
+			BodyState k7 = Eval(f, next);
+			BodyState error = (k1 * (71.0f / 57600) + k3 * (-71.0f / 16695) + k4 * (71.0f / 1920)
+			                   + k5 * (-17253.0f / 339200) + k6 * (22.0f / 525) + k7 * (-1.0f / 40)) * step;
+			float ratio = error.MaxAbs() / tolerance;
+			if (ratio <= 1 || step <= hMin) { // accept
+				s = next;
+				t += step;
+			}
+			h = step * fminf(5.0f, fmaxf(0.2f, 0.9f * powf(fmaxf(ratio, 1e-10f), -0.2f)));
+		}
+	}
+};
+
+inline Integrator * NewIntegrator(Integration scheme) {
+	switch (scheme) {
+	case SemiImplicitEuler: return new SymplecticEulerIntegrator();
+	case VelocityVerlet:    return new VerletIntegrator();
+	case RungeKutta4:       return new RK4Integrator();
+	case RungeKutta45:      return new RK45Integrator();
+	default:                return new EulerIntegrator();
+	}
+}
+
+// Quaternions in vec4(x, y, z, w), rotating like RotationMatrix(angle, axis) for row vectors
+inline vec4 QuatAxisAngle(vec3 axis, float angle) {
+	vec3 u = normalize(axis) * sinf(angle / 2);
+	return vec4(u.x, u.y, u.z, cosf(angle / 2));
+}
+
+inline vec4 QuatMul(vec4 a, vec4 b) { // a after b
+	vec3 u(a.x, a.y, a.z), v(b.x, b.y, b.z);
+	vec3 r = v * a.w + u * b.w + cross(u, v);
+	return vec4(r.x, r.y, r.z, a.w * b.w - dot(u, v));
+}
+
+inline vec4 QuatConjugate(vec4 q) { return vec4(-q.x, -q.y, -q.z, q.w); }
+
+inline vec3 QuatRotate(vec4 q, vec3 v) {
+	vec3 u(q.x, q.y, q.z);
+	vec3 t = cross(u, v) * 2;
+	return v + t * q.w + cross(u, t);
+}
+
+inline mat4 QuatMatrix(vec4 q) { // rows are the images of the axes
+	vec3 x = QuatRotate(q, vec3(1, 0, 0)), y = QuatRotate(q, vec3(0, 1, 0)), z = QuatRotate(q, vec3(0, 0, 1));
+	return mat4(vec4(x.x, x.y, x.z, 0), vec4(y.x, y.y, y.z, 0), vec4(z.x, z.y, z.z, 0), vec4(0, 0, 0, 1));
+}
+
+inline vec4 QuatNlerp(vec4 a, vec4 b, float t) {
+	if (dot(a, b) < 0) b = b * -1; // the shorter way
+	vec4 q = a * (1 - t) + b * t;
+	return q / sqrtf(dot(q, q));
+}
+
+//---------------------------
+struct Attachment { // rigid body at the end of a rope, moved by positional impulses
+//---------------------------
+	virtual vec3 AttachmentPoint() = 0;
+	virtual float InverseMass(vec3 n) = 0; // generalized, for a push along n at the attachment point
+	virtual void Correct(vec3 p, float dt) = 0; // positional impulse at the attachment point within a step of dt
+	virtual vec3 Gravity() const = 0;           // of the world the rope hangs in
+	virtual float Drag() const = 0;             // of the air, velocity lost per second per unit velocity
+	virtual ~Attachment() { }
+};
+
+//---------------------------
+class Rope { // rubber rope as a chain of particles held together by XPBD distance constraints
+//---------------------------
+	std::vector<vec3> x, v, prev; // particle 0 is the fixed anchor, the last one follows the attachment
+	std::vector<float> w;         // inverse masses
+	std::vector<float> lambda;    // accumulated multipliers of the segments, <= 0 as the rope can only pull
+	float segmentLength, compliance;
+	float tension = 0;            // force of the last segment on the body in the last step
+	int iterations;
+	vec3 g = vec3(0, 0, 0);       // of the body, taken by every Step
+public:
+	// nSegments >= 1, stiffness of the whole rope in N/m, mass of the whole rope. Gauss-Seidel sweeps along the chain
+	// carry a correction one segment further each, so longer ropes need more of them: without _iterations they grow
+	// with the segments, BenchmarkRope shows the stretch error left
+	Rope(vec3 anchor, vec3 end, float restLength, int nSegments, float stiffness, float mass = 0.1f, int _iterations = 0) {
+		for (int i = 0; i <= nSegments; i++) x.push_back(anchor + (end - anchor) * ((float)i / nSegments));
+		v.resize(x.size(), vec3(0, 0, 0));
+		prev = x;
+		w.resize(x.size(), nSegments / mass);
+		w[0] = 0;
+		lambda.resize(nSegments);
+		segmentLength = restLength / nSegments;
+		compliance = 1 / (stiffness * nSegments); // segments are springs in series
+		iterations = (_iterations > 0) ? _iterations : std::max(20, nSegments / 10);
+	}
+
+	int Segments() const { return (int)lambda.size(); }
+
+	// Advances the free particles by dt and resolves the constraints with the body at the end
+	void Step(Attachment& body, float dt) {
+		int n = Segments();
+		float drag = body.Drag();
+		g = body.Gravity();
+		for (int i = 1; i < n; i++) {
+			prev[i] = x[i];
+			v[i] = (v[i] + g * dt) * (1 - drag * dt);
+			x[i] = x[i] + v[i] * dt;
+		}
+		x[n] = body.AttachmentPoint();
+		float alpha = compliance / (dt * dt);
+		std::fill(lambda.begin(), lambda.end(), 0.0f);
+		for (int it = 0; it < iterations; it++) {
+			for (int i = 0; i < n; i++) {
+				vec3 d = x[i + 1] - x[i];
+				float len = length(d);
+				if (len < 1e-6f) continue;
+				vec3 dir = d / len;
+				float wi = w[i], wj = (i + 1 == n) ? body.InverseMass(dir) : w[i + 1];
+				float C = len - segmentLength;
+				float newLambda = fminf(lambda[i] + (-C - alpha * lambda[i]) / (wi + wj + alpha), 0); // slack: no push
+				float dl = newLambda - lambda[i];
+				lambda[i] = newLambda;
+				x[i] = x[i] - dir * (wi * dl);
+				if (i + 1 == n) {
+					body.Correct(dir * dl, dt);
+					x[n] = body.AttachmentPoint();
+				} else {
+					x[i + 1] = x[i + 1] + dir * (wj * dl);
+				}
+			}
+		}
+		for (int i = 1; i < n; i++) v[i] = (x[i] - prev[i]) / dt;
+		tension = -lambda[n - 1] / (dt * dt);
+	}
+
+	const std::vector<vec3>& Particles() const { return x; }
+
+	float Extension() const { // length beyond the rest length, negative if slack
+		float len = 0;
+		for (int i = 0; i < Segments(); i++) len += length(x[i + 1] - x[i]);
+		return len - segmentLength * Segments();
+	}
+
+	float Elastic() const { // energy stored in the stretched segments
+		float energy = 0;
+		for (int i = 0; i < Segments(); i++) {
+			float stretch = fmaxf(length(x[i + 1] - x[i]) - segmentLength, 0);
+			energy += stretch * stretch / (2 * compliance);
+		}
+		return energy;
+	}
+
+	float Tension() const { return tension; }
+
+	float Kinetic() const { // of the free particles
+		float energy = 0;
+		for (int i = 1; i < Segments(); i++) energy += dot(v[i], v[i]) / (2 * w[i]);
+		return energy;
+	}
+
+	float Potential() const { // gravitational, of the free particles
+		float energy = 0;
+		for (int i = 1; i < Segments(); i++) energy -= dot(g, x[i]) / w[i];
+		return energy;
+	}
+
+	vec3 Pull() const { // force on the body at its attachment
+		vec3 d = x[Segments() - 1] - x[Segments()];
+		return length(d) > 1e-6f ? normalize(d) * tension : vec3(0, 0, 0);
+	}
+
+	float MaxSpeed() const { // of the particles in the last step
+		float speed = 0;
+		for (const vec3& u : v) speed = fmaxf(speed, length(u));
+		return speed;
+	}
+};
+
+//---------------------------
+struct BodyPose { // what drawing needs of the state of a Body
+//---------------------------
+	vec3 translation;
+	float rotationAngle;
+	vec4 q;
+
+	BodyPose(vec3 _translation = vec3(0, 0, 0), float _rotationAngle = 0, vec4 _q = vec4(0, 0, 0, 1))
+		: translation(_translation), rotationAngle(_rotationAngle), q(_q) { }
+
+	BodyPose Lerp(const BodyPose& to, float t) const { // t of the way to the other pose
+		return BodyPose(translation * (1 - t) + to.translation * t, rotationAngle * (1 - t) + to.rotationAngle * t,
+		                QuatNlerp(q, to.q, t));
+	}
+};
+
+//---------------------------
+struct ProbeSample { // the jumper after a physics step, see instrumentPhysics
+//---------------------------
+	double time = 0;
+	float kinetic = 0, potential = 0, elastic = 0; // J: motion, gravity (both with the rope particles), rope stretch
+	float extension = 0, tension = 0;              // of the rope beyond its rest length, m and N
+	float torque = 0, omega = 0;                   // around the rotation axis, magnitudes for the free body
+
+	float Energy() const { return kinetic + potential + elastic; }
+};
+
+extern bool goon; // the jumper has left the platform
+struct Body : public Placement, public Dynamics, public Attachment {
+	float m = 1;
+	vec3 g = vec3(0, -5, 0);
+	vec3 v = vec3(1, 0, 0);
+	float ro = 0.3;
+	vec3 s = vec3(0,5,0);
+	float D = 1;
+	float l0 = 3;
+	vec3 w = vec3(0,0,0);
+	float kappa = 0.3;
+	Rope * rope = nullptr; // pulls through Correct instead of the spring when set
+	bool eventDriven = eventDrivenRope; // Advance instead of one integrator step, for the planar spring model
+	float maxLoadedStep = 0.001f;       // of Advance while the spring pulls
+	float eventStep = 0.01f;            // slack flights are searched this far ahead for the taut time, whatever the step
+	BodyState flight, flown;            // start of the slack flight in progress and its state last returned
+	float flightTime = -1;              // into the flight, -1 if none is in progress
+	float tautAt = -1, searched = 0;    // taut time of the flight if found within its first searched seconds
+
+	// free rotation: orientation q, world angular velocity w, box inertia tensor, scale must not change after the first step
+	bool free3D = rigidBody3D;
+	vec4 q = vec4(0, 0, 0, 1), prevQ = vec4(0, 0, 0, 1);
+	vec3 invInertiaWorld[3]; // rows of R^T diag(1/I) R, follows q
+	bool inertiaValid = false;
+	
+	vec3 prevTranslation;    // state of the previous physics step
+	float prevRotationAngle = 0;
+	float restTime = 0;      // spent below sleepSpeed, together with the rope
+	bool asleep = false;     // fell asleep after the launch, not stepped until the next one
+	Integrator * integrator = NewIntegrator(bodyIntegrator);
+	
+	Body() {
+		rotationAxis = vec3(0, 0, 1);
+	}
+
+	void Configure(const Body& like) { // take its physical parameters, before the first step
+		m = like.m;
+		ro = like.ro;
+		D = like.D;
+		l0 = like.l0;
+		kappa = like.kappa;
+	}
+
+	void Settle() { // forget the previous state, e.g. after placing the body
+		Settle(Pose());
+	}
+
+	void Settle(const BodyPose& p) { // as if the step began at p
+		prevTranslation = p.translation;
+		prevRotationAngle = p.rotationAngle;
+		prevQ = p.q;
+	}
+
+	BodyPose Pose() const { return BodyPose(translation, rotationAngle, q); }
+	BodyPose PrevPose() const { return BodyPose(prevTranslation, prevRotationAngle, prevQ); }
+
+	void Place(const BodyPose& p) { // the velocities and the previous state are kept
+		translation = p.translation;
+		rotationAngle = p.rotationAngle;
+		q = p.q;
+		inertiaValid = false;
+	}
+
+	// Modeling transform at pose p, the physics state is not read
+	void Transform(const BodyPose& p, mat4& M, mat4& Minv) const {
+		mat4 R = free3D ? QuatMatrix(p.q) : RotationMatrix(p.rotationAngle, rotationAxis);
+		mat4 Rinv = free3D ? QuatMatrix(QuatConjugate(p.q)) : RotationMatrix(-p.rotationAngle, rotationAxis);
+		M = ScaleMatrix(scale) * R * TranslateMatrix(p.translation);
+		Minv = TranslateMatrix(-p.translation) * Rinv * ScaleMatrix(vec3(1 / scale.x, 1 / scale.y, 1 / scale.z));
+	}
+
+	void SetModelingTransform(mat4& M, mat4& Minv) override { Transform(Pose(), M, Minv); }
+
+	// Random initial velocity of the jump-th launch, in the symmetry plane of the body
+	void Launch(CounterRNG rng, uint64_t jump) {
+		v = vec3(rng.Uniform(0.5f, 2.0f, jump, 0), rng.Uniform(0.0f, 1.0f, jump, 1), 0);
+		asleep = false;
+		restTime = 0;
+	}
+
+	~Body() { delete integrator; }
+
+	// The planar state around rotationAxis; of a free body the twist of q and the spin around the axis,
+	// its full orientation stays in q, see Anchor
+	BodyState State() const {
+		float angle = free3D ? 2 * atan2f(dot(vec3(q.x, q.y, q.z), normalize(rotationAxis)), q.w) : rotationAngle;
+		return BodyState(translation, v, angle, dot(rotationAxis, w));
+	}
+
+	void SetState(const BodyState& state) { // planar bodies only, a free body is stepped by Step3D
+		translation = state.x;
+		v = state.v;
+		rotationAngle = state.angle;
+		w = rotationAxis * state.omega;
+	}
+
+	float Inertia() const { return m * (scale.x * scale.x + scale.y * scale.y) / 12; }
+
+	vec3 InertiaTensor() const { // principal moments of the box in its own frame
+		vec3 s2 = scale * scale;
+		return vec3(s2.y + s2.z, s2.x + s2.z, s2.x + s2.y) * (m / 12);
+	}
+
+	void UpdateInertia() {
+		vec3 I = InertiaTensor();
+		vec3 a = QuatRotate(q, vec3(1, 0, 0)), b = QuatRotate(q, vec3(0, 1, 0)), c = QuatRotate(q, vec3(0, 0, 1));
+		vec3 ai = a / I.x, bi = b / I.y, ci = c / I.z;
+		invInertiaWorld[0] = ai * a.x + bi * b.x + ci * c.x;
+		invInertiaWorld[1] = ai * a.y + bi * b.y + ci * c.y;
+		invInertiaWorld[2] = ai * a.z + bi * b.z + ci * c.z;
+		inertiaValid = true;
+	}
+
+	vec3 InverseInertia(vec3 t) const { return vec3(dot(invInertiaWorld[0], t), dot(invInertiaWorld[1], t), dot(invInertiaWorld[2], t)); }
+
+	void Rotate(vec3 dtheta) { // by a small world space rotation vector
+		q = q + QuatMul(vec4(dtheta.x, dtheta.y, dtheta.z, 0), q) * 0.5f;
+		q = q / sqrtf(dot(q, q));
+		UpdateInertia();
+	}
+
+	// Body frame angular velocity after dt of torque free motion, solved implicitly (one Newton step)
+	// so that the gyroscopic term w x Iw does not gain energy
+	vec3 GyroscopicStep(vec3 wb, float dt) const {
+		vec3 I = InertiaTensor(), Iw = I * wb;
+		vec3 f = cross(wb, Iw) * dt;
+		vec3 e[3] = { vec3(1, 0, 0), vec3(0, 1, 0), vec3(0, 0, 1) };
+		float Ik[3] = { I.x, I.y, I.z };
+		vec3 c[3]; // columns of the Jacobian I + dt (skew(w) I - skew(Iw))
+		for (int k = 0; k < 3; k++) c[k] = e[k] * Ik[k] + (cross(wb, e[k]) * Ik[k] - cross(Iw, e[k])) * dt;
+		float det = dot(c[0], cross(c[1], c[2]));
+		vec3 x(dot(f, cross(c[1], c[2])), dot(c[0], cross(f, c[2])), dot(c[0], cross(c[1], f)));
+		return wb - x / det;
+	}
+
+	void Step3D(float dt) { // semi-implicit Euler of the free rigid body
+		if (!inertiaValid) UpdateInertia();
+		vec3 r = AttachmentPoint() - translation;
+		vec3 K(0, 0, 0);
+		if (!rope && length(s - translation - r) > l0) {
+			K = D*(s-translation-r)*(length(s-translation-r) - l0);
+		}
+		v = v + (g + (K - ro * v) / m) * dt;
+		translation = translation + v * dt;
+		w = w + InverseInertia(cross(r, K) - kappa * w) * dt;
+		w = QuatRotate(q, GyroscopicStep(QuatRotate(QuatConjugate(q), w), dt));
+		Rotate(w * dt);
+	}
+
+	vec3 Anchor(const BodyState& state) const { // where the rope is attached to the body
+		if (free3D) return state.x + QuatRotate(q, vec3(0, -0.5f * scale.y, 0)); // BodyState has no room for q
+		// (0, -0.5, 0, 1) * ScaleMatrix(scale) * RotationMatrix(state.angle, rotationAxis) * TranslateMatrix(state.x),
+		// only the y row of the rotation is needed
+		vec3 w = normalize(rotationAxis);
+		float c = cosf(state.angle), s = sinf(state.angle);
+		vec3 up(w.x * w.y * (1 - c) - w.z * s, c * (1 - w.y * w.y) + w.y * w.y, w.y * w.z * (1 - c) + w.x * s);
+		return state.x - up * (0.5f * scale.y);
+	}
+
+	BodyState Derivative(const BodyState& state) override {
+		vec3 l = Anchor(state);
+		vec3 K(0, 0, 0);
+		if(!rope && length(s-l) > l0) {
+			K = D*(s-l)*(length(s-l) - l0);
+		}
+		vec3 F = m * g + K - ro * state.v;
+		float torque = dot(rotationAxis, cross(l - state.x, K)) - kappa * state.omega;
+		return BodyState(state.v, F / m, state.omega, torque / Inertia());
+	}
+
+	float Stretch(const BodyState& state) const { return length(s - Anchor(state)) - l0; } // the spring pulls if positive
+
+	// Closed form motion under gravity and linear drag, valid while the rope is slack
+	BodyState FreeFlight(const BodyState& state, float t) const {
+		// expm1f and the series keep the digits that 1 - expf(-x) loses over a short frame
+		float k = ro / m, c = kappa / Inertia(), x = k * t;
+		float settle = k > 1e-6f ? -expm1f(-x) / k : t; // integral of the velocity decay
+		float drift = x > 0.01f ? (t - settle) / k : t * t * (0.5f - x / 6 + x * x / 24); // integral of settle
+		float spin = c > 1e-6f ? -expm1f(-c * t) / c : t;
+		return BodyState(state.x + state.v * settle + g * drift, state.v * expf(-x) + g * settle,
+		                 state.angle + state.omega * spin, state.omega * expf(-c * t));
+	}
+
+	// First time in (0, h] at which a slack rope becomes taut, -1 if it stays slack. The returned time
+	// is the upper end of the bisection bracket, so FreeFlight lands just on the taut side.
+	float TautTime(const BodyState& state, float h) const {
+		int nSamples = 1 + (int)(h / 0.01f); // bracket the first crossing, 10 ms apart at most
+		float lo = 0;
+		for (int k = 1; k <= nSamples; k++) {
+			float hi = h * k / nSamples;
+			if (Stretch(FreeFlight(state, hi)) > 0) {
+				for (int it = 0; it < 32; it++) {
+					float mid = (lo + hi) / 2;
+					if (Stretch(FreeFlight(state, mid)) > 0) hi = mid;
+					else lo = mid;
+				}
+				return hi;
+			}
+			lo = hi;
+		}
+		return -1;
+	}
+
+	// Advances by h: slack phases analytically to the taut event, loaded phases numerically
+	// in steps of at most maxLoadedStep, shortened to end just after the rope goes slack again
+	void Advance(BodyState& state, float h) {
+		while (h > 0) {
+			if (Stretch(state) <= 0) {
+				float taut = TautTime(state, h);
+				float step = taut < 0 ? h : taut;
+				state = FreeFlight(state, step);
+				h -= step;
+				continue;
+			}
+			float step = fminf(h, maxLoadedStep);
+			BodyState next = state;
+			integrator->Step(*this, next, step);
+			if (Stretch(next) <= 0) {
+				float lo = 0, hi = step;
+				for (int it = 0; it < 24; it++) {
+					float mid = (lo + hi) / 2;
+					BodyState trial = state;
+					integrator->Step(*this, trial, mid);
+					if (Stretch(trial) <= 0) hi = mid;
+					else lo = mid;
+				}
+				step = hi;
+				next = state;
+				integrator->Step(*this, next, step);
+			}
+			state = next;
+			h -= step;
+		}
+	}
+
+	// Advance by a scene step h of its own: a slack flight is evaluated in closed form from where it began and
+	// its taut time is searched eventStep ahead at a time, so neither depends on the step of the scene
+	void FollowFlight(BodyState& state, float h) {
+		if (flightTime < 0 || memcmp(&state, &flown, sizeof(BodyState)) != 0) { // no flight, or pushed off it
+			if (Stretch(state) > 0) {
+				flightTime = -1;
+				Advance(state, h);
+				return;
+			}
+			flight = state;
+			flightTime = 0;
+			tautAt = -1;
+			searched = 0;
+		}
+		float end = flightTime + h;
+		while (tautAt < 0 && searched < end) {
+			float t = TautTime(FreeFlight(flight, searched), eventStep);
+			if (t >= 0) tautAt = searched + t;
+			searched += eventStep;
+		}
+		if (tautAt >= 0 && tautAt <= end) { // in closed form to the taut time, then loaded
+			state = FreeFlight(flight, tautAt);
+			flightTime = -1;
+			Advance(state, end - tautAt);
+			return;
+		}
+		state = flown = FreeFlight(flight, flightTime = end);
+	}
+
+	float Energy(const BodyState& state) const { // kinetic, gravitational and rope, lost only to damping
+		float r = fmaxf(length(s - Anchor(state)), l0); // the rope pulls with D * r * (r - l0)
+		return m * dot(state.v, state.v) / 2 + Inertia() * state.omega * state.omega / 2 - m * dot(g, state.x)
+		       + D * (r * r * r / 3 - l0 * r * r / 2 + l0 * l0 * l0 / 6);
+	}
+
+	void Animate(float tstart, float tend) { // one step, nothing before the launch or while asleep
+		Settle();
+		if(!goon || asleep) {
+			return;
+		}
+		Move(tend - tstart);
+		if (rope) rope->Step(*this, tend - tstart);
+	}
+
+	// The body alone by h, the rope corrects it in its own step
+	void Move(float h) {
+		if (free3D) {
+			Step3D(h);
+		} else {
+			BodyState state = State();
+			if (eventDriven && !rope) FollowFlight(state, h);
+			else integrator->Step(*this, state, h);
+			SetState(state);
+		}
+	}
+
+	bool Asleep() const { return asleep; } // a body waiting for the launch is not asleep, only not stepped yet
+
+	// Energies and the pull of the rope in the current state, for the instrumentation
+	ProbeSample Measure(double time) {
+		ProbeSample p;
+		p.time = time;
+		vec3 a = AttachmentPoint(), pull(0, 0, 0);
+		if (free3D) {
+			vec3 wb = QuatRotate(QuatConjugate(q), w);
+			p.kinetic = m * dot(v, v) / 2 + dot(wb, InertiaTensor() * wb) / 2;
+		} else {
+			p.kinetic = m * dot(v, v) / 2 + Inertia() * dot(rotationAxis, w) * dot(rotationAxis, w) / 2;
+		}
+		p.potential = -m * dot(g, translation);
+		if (rope) {
+			p.kinetic += rope->Kinetic();
+			p.potential += rope->Potential();
+			p.elastic = rope->Elastic();
+			p.extension = rope->Extension();
+			p.tension = rope->Tension();
+			pull = rope->Pull();
+		} else { // the spring of Derivative pulls with D * r * (r - l0)
+			float r = length(s - a);
+			p.extension = r - l0;
+			if (p.extension > 0) {
+				p.elastic = D * (r * r * r / 3 - l0 * r * r / 2 + l0 * l0 * l0 / 6);
+				p.tension = D * r * p.extension;
+				pull = (s - a) * (D * p.extension);
+			}
+		}
+		vec3 torque = cross(a - translation, pull) - kappa * w;
+		p.torque = free3D ? length(torque) : dot(rotationAxis, torque);
+		p.omega = free3D ? length(w) : dot(rotationAxis, w);
+		return p;
+	}
+
+	// After a step and its collisions: falls asleep once the body and its rope stayed slow for sleepTime
+	void Rest(float dt) {
+		if (!sleepAtRest || !goon || asleep) return;
+		float speed = fmaxf(length(v), length(w));
+		if (rope) speed = fmaxf(speed, rope->MaxSpeed());
+		restTime = speed < sleepSpeed ? restTime + dt : 0;
+		if (restTime >= sleepTime) {
+			asleep = true;
+			v = w = vec3(0, 0, 0);
+		}
+	}
+
+	vec3 VelocityAt(vec3 p) const { return v + cross(w, p - translation); }
+
+	float InverseMassAt(vec3 p, vec3 n) { // generalized, for an impulse along n at the world point p
+		vec3 arm = cross(p - translation, n);
+		if (!free3D) return 1 / m + dot(rotationAxis, arm) * dot(rotationAxis, arm) / Inertia();
+		if (!inertiaValid) UpdateInertia();
+		return 1 / m + dot(arm, InverseInertia(arm));
+	}
+
+	void ApplyImpulse(vec3 p, vec3 J) { // at the world point p, changes the velocities only
+		vec3 arm = cross(p - translation, J);
+		v = v + J / m;
+		if (free3D) w = w + InverseInertia(arm);
+		else w = w + rotationAxis * (dot(rotationAxis, arm) / Inertia());
+	}
+
+	vec3 AttachmentPoint() override { return Anchor(State()); }
+
+	float InverseMass(vec3 n) override { return InverseMassAt(AttachmentPoint(), n); }
+
+	vec3 Gravity() const override { return g; }
+
+	float Drag() const override { return ro / m; } // the rope slows down like the body
+
+	void Correct(vec3 p, float dt) override {
+		vec3 arm = cross(AttachmentPoint() - translation, p);
+		translation = translation + p / m;
+		v = v + p / (m * dt);
+		if (free3D) {
+			vec3 turn = InverseInertia(arm);
+			Rotate(turn);
+			w = w + turn / dt;
+			return;
+		}
+		float turn = dot(rotationAxis, arm) / Inertia();
+		rotationAngle += turn;
+		w = w + rotationAxis * (turn / dt);
+	}
+
+};
+// sinf and cosf without calls and branches, so that loops using them vectorize, error about 1e-7
+inline void SinCos(float a, float& s, float& c) {
+	float q = (float)(int)(a * 0.636619772f + copysignf(0.5f, a)); // nearest multiple of pi/2
+	float r = (a - q * 1.5703125f) - q * 4.8382679e-4f;                 // in [-pi/4, pi/4]
+	float r2 = r * r;
+	float sr = r + r * r2 * (-1.0f / 6 + r2 * (1.0f / 120 + r2 * (-1.0f / 5040 + r2 * (1.0f / 362880))));
+	float cr = 1 + r2 * (-0.5f + r2 * (1.0f / 24 + r2 * (-1.0f / 720 + r2 * (1.0f / 40320))));
+	int n = (int)q;
+	float odd = (float)(n & 1); // sin and cos swap in odd quadrants
+	s = (sr + odd * (cr - sr)) * (float)(1 - (n & 2));
+	c = (cr + odd * (sr - cr)) * (float)(1 - ((n + 1) & 2));
+}
+
+//---------------------------
+class StepPool { // persistent threads running the chunks of a job, idle threads steal chunks from busy ones
+//---------------------------
+	struct alignas(64) Range { std::atomic<uint64_t> chunks{ 0 }; }; // [begin, end) of a thread: begin << 32 | end
+	std::vector<Range> ranges; // one per thread, the caller of Run is thread 0
+	std::function<void(int)> job;
+	std::mutex mutex;
+	std::condition_variable wakeup, finished;
+	long long generation = 0; // of the job
+	int running = 0;          // workers still on the job
+	bool quit = false;
+	std::vector<std::thread> workers;
+
+	bool Pop(int self, int& chunk) { // from the front of the own range
+		uint64_t r = ranges[self].chunks.load();
+		while ((uint32_t)(r >> 32) < (uint32_t)r) {
+			if (ranges[self].chunks.compare_exchange_weak(r, r + (1ull << 32))) {
+				chunk = (int)(r >> 32);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool Steal(int self, int& chunk) { // from the back of the range of another thread
+		for (int k = 1; k < Threads(); k++) {
+			Range& victim = ranges[(self + k) % Threads()];
+			uint64_t r = victim.chunks.load();
+			while ((uint32_t)(r >> 32) < (uint32_t)r) {
+				if (victim.chunks.compare_exchange_weak(r, r - 1)) {
+					chunk = (int)(uint32_t)r - 1;
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	void Work(int self) {
+		int chunk;
+		while (Pop(self, chunk) || Steal(self, chunk)) job(chunk);
+	}
+
+	void Worker(int self) {
+		long long seen = 0;
+		for (;;) {
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wakeup.wait(lock, [&] { return quit || generation != seen; });
+				if (quit) return;
+				seen = generation;
+			}
+			Work(self);
+			std::lock_guard<std::mutex> lock(mutex);
+			if (--running == 0) finished.notify_one();
+		}
+	}
+public:
+	StepPool(int nThreads) : ranges(std::max(nThreads, 1)) {
+		for (int i = 1; i < Threads(); i++) workers.emplace_back(&StepPool::Worker, this, i);
+	}
+
+	~StepPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			quit = true;
+		}
+		wakeup.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	int Threads() const { return (int)ranges.size(); }
+
+	// Calls f(chunk) for every chunk in [0, nChunks) on all threads, returns when each is done
+	void Run(int nChunks, std::function<void(int)> f) {
+		int n = Threads();
+		for (int i = 0; i < n; i++)
+			ranges[i].chunks = (uint64_t)(nChunks * i / n) << 32 | (uint32_t)(nChunks * (i + 1) / n);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			job = std::move(f);
+			running = n - 1;
+			generation++;
+		}
+		wakeup.notify_all();
+		Work(0);
+		std::unique_lock<std::mutex> lock(mutex);
+		finished.wait(lock, [this] { return running == 0; });
+	}
+};
+
+//---------------------------
+template<class T> class TripleBuffer { // one writer and one reader pass whole Ts without locks, neither ever waits
+//---------------------------
+	static const int fresh = 4;   // flag of the middle slot: published and not taken yet
+	T buffers[3];
+	std::atomic<int> middle{ 1 }; // slot between the writer and the reader
+	int back = 0, front = 2;      // slot of the writer, slot of the reader
+public:
+	T& Back() { return buffers[back]; } // to be filled by the writer, then published
+
+	void Publish() { back = middle.exchange(back | fresh, std::memory_order_acq_rel) & 3; }
+
+	const T& Latest() { // the last published T, valid until the next call
+		if (middle.load(std::memory_order_relaxed) & fresh) front = middle.exchange(front, std::memory_order_acq_rel) & 3;
+		return buffers[front];
+	}
+};
+
+//---------------------------
+class BodySystem { // many jumpers in structure of arrays form, integrated in SIMD batches
+//---------------------------
+	// hot state and parameters, one array per scalar so that a batch of bodies fills a vector register
+	std::vector<float> px, py, pz, vx, vy, vz, angle, omega;              // state, rotation around z like Body
+	std::vector<float> sx, sy, sz, restLength, stiffness, invMass, drag;  // rope anchor s, l0, D, 1/m, ro
+	std::vector<float> halfHeight, angularDrag, invInertia;              // lever of the rope, kappa, 1/I
+	std::vector<float> restTime;                                          // below sleepSpeed, asleep from sleepTime on
+	std::vector<int> awake;    // bodies of each chunk still stepped, chunks without any are skipped
+	std::vector<vec3> extents; // cold, only for drawing and collisions
+	vec3 g = vec3(0, -5, 0);
+
+	struct Contact { // of two overlapping boxes, or of two boxes swept into each other
+		int a, b;       // a < b
+		vec3 n;         // unit, from a towards b
+		float depth;    // along n, the gap is negative
+		float time = 1; // of impact as the fraction of the step, 1 for boxes overlapping at its end
+	};
+
+	// Spatial hash rebuilt every step: bodies sorted by the bucket of the cell of their center, a counting sort in O(N),
+	// then by cell within the bucket so that the bodies of a cell are consecutive.
+	// Cells are as large as the largest body along each axis, so overlapping bodies are in the same or in neighboring
+	// cells. The boxes turn around z only, their bounds are a disk in the xy plane and their depth along z.
+	// With continuous collisions and fast bodies the bounds and the cells grow by the longest move of the step.
+	vec3 cellSize = vec3(0, 0, 0), gridSize = vec3(0, 0, 0); // largest body, and the cells of this step
+	std::vector<float> radius;             // of the bounding disks in the xy plane
+	struct Slot {   // a body in sorted order, all that the scan of a bucket reads in 32 bytes
+		vec4 pose;  // position and angle
+		int cell[3];
+		int body;
+	};
+	std::vector<int> bucketStart, cursor;  // bucket k holds sorted[bucketStart[k] .. bucketStart[k + 1])
+	std::vector<int> bucketOf;
+	std::vector<Slot> sorted;
+	std::vector<std::vector<Contact>> chunkContacts; // found by the chunks in parallel, merged in chunk order
+
+	// Continuous collisions: the bodies are swept from the state before the step on straight lines
+	std::vector<float> ox, oy, oz, oangle; // position and angle before the step
+	std::vector<vec2> sweep;               // length of the move in the xy plane and along z
+	std::vector<float> travel;             // farthest move of a point of the box
+	float thinnest = 1e30f;                // side of any box, slower pairs cannot pass each other in a step
+	bool swept = false;                    // some pair is fast enough in this step, the bounds grow by the sweeps
+	std::vector<float> impact;             // earliest time of impact of the step, 1 if none
+	std::vector<int> rewound;              // bodies with an impact
+
+	vec4 Pose(int i) const { return vec4(px[i], py[i], pz[i], angle[i]); }
+
+	vec4 Start(int i) const { // pose before the step, sleepers were not stepped
+		return restTime[i] < sleepTime ? vec4(ox[i], oy[i], oz[i], oangle[i]) : Pose(i);
+	}
+
+	void Save(int begin, int end) { // the state before the step
+		std::copy(px.begin() + begin, px.begin() + end, ox.begin() + begin);
+		std::copy(py.begin() + begin, py.begin() + end, oy.begin() + begin);
+		std::copy(pz.begin() + begin, pz.begin() + end, oz.begin() + begin);
+		std::copy(angle.begin() + begin, angle.begin() + end, oangle.begin() + begin);
+	}
+
+	int Cell(float x, float size) const { return (int)floorf(x / size); }
+
+	int Bucket(int x, int y, int z) const {
+		uint32_t h = (uint32_t)x * 73856093u ^ (uint32_t)y * 19349663u ^ (uint32_t)z * 83492791u;
+		return (int)(h & (uint32_t)(bucketStart.size() - 2)); // the number of buckets is a power of two
+	}
+
+	void BuildGrid() {
+		int n = Size(), nBuckets = 1;
+		while (nBuckets < 2 * n) nBuckets <<= 1;
+		bucketStart.assign(nBuckets + 1, 0);
+		bucketOf.resize(n);
+		sorted.resize(n);
+		gridSize = cellSize;
+		swept = false;
+		if (continuous) {
+			vec2 longest(0, 0);
+			float farthest = 0;
+			sweep.resize(n);
+			travel.resize(n);
+			for (int i = 0; i < n; i++) {
+				vec4 d = Pose(i) - Start(i);
+				sweep[i] = vec2(length(vec2(d.x, d.y)), fabsf(d.z));
+				travel[i] = length(vec3(d.x, d.y, d.z)) + radius[i] * fabsf(d.w);
+				longest = vec2(fmaxf(longest.x, sweep[i].x), fmaxf(longest.y, sweep[i].y));
+				farthest = fmaxf(farthest, travel[i]);
+			}
+			swept = 2 * farthest >= thinnest / 2;
+			if (swept) gridSize = gridSize + vec3(longest.x, longest.x, longest.y) * 2;
+		}
+		for (int i = 0; i < n; i++) {
+			bucketOf[i] = Bucket(Cell(px[i], gridSize.x), Cell(py[i], gridSize.y), Cell(pz[i], gridSize.z));
+			bucketStart[bucketOf[i] + 1]++;
+		}
+		for (int k = 0; k < nBuckets; k++) bucketStart[k + 1] += bucketStart[k];
+		cursor.assign(bucketStart.begin(), bucketStart.end() - 1);
+		for (int i = 0; i < n; i++) { // stable, bodies of a bucket stay in index order
+			int cell[3] = { Cell(px[i], gridSize.x), Cell(py[i], gridSize.y), Cell(pz[i], gridSize.z) };
+			sorted[cursor[bucketOf[i]]++] = { vec4(px[i], py[i], pz[i], angle[i]), { cell[0], cell[1], cell[2] }, i };
+		}
+		for (int k = 0; k < nBuckets; k++) { // cells sharing a bucket are rare, insertion sort keeps the index order
+			for (int a = bucketStart[k] + 1; a < bucketStart[k + 1]; a++) {
+				Slot slot = sorted[a];
+				int b = a;
+				for (; b > bucketStart[k] && CellBefore(slot, sorted[b - 1]); b--) sorted[b] = sorted[b - 1];
+				sorted[b] = slot;
+			}
+		}
+	}
+
+	static bool SameCell(const Slot& a, const Slot& b) {
+		return a.cell[0] == b.cell[0] && a.cell[1] == b.cell[1] && a.cell[2] == b.cell[2];
+	}
+
+	static bool CellBefore(const Slot& a, const Slot& b) {
+		for (int k = 2; k >= 0; k--) if (a.cell[k] != b.cell[k]) return a.cell[k] < b.cell[k];
+		return false;
+	}
+
+	// Appends the contact of the sorted bodies a and b if they overlap or were swept into each other and are not
+	// both asleep. Pairs closing less than half the thinnest side in the step are only tested at its end.
+	void Test(const Slot& a, const Slot& b, std::vector<Contact>& out) const {
+		float dx = b.pose.x - a.pose.x, dy = b.pose.y - a.pose.y, r = radius[a.body] + radius[b.body];
+		if (swept) r += sweep[a.body].x + sweep[b.body].x;
+		if (fabsf(b.pose.z - a.pose.z) >= gridSize.z || dx * dx + dy * dy >= r * r) return;
+		if (restTime[a.body] >= sleepTime && restTime[b.body] >= sleepTime) return;
+		Contact contact;
+		bool fast = swept && travel[a.body] + travel[b.body] >= thinnest / 2;
+		if (!(fast && Impact(a.body, b.body, contact)) && !Overlap(a.body, b.body, a.pose, b.pose, contact)) return;
+		if (b.body < a.body) contact = { b.body, a.body, contact.n * -1, contact.depth, contact.time };
+		out.push_back(contact);
+	}
+
+	// Smallest overlap of the boxes a and b at the poses pa and pb along the separating axes, both rotated around z
+	// only: the in-plane axes of the two and z. Negative if an axis separates them, by no more than their distance.
+	// n is that axis, from a towards b. Returns as soon as an axis overlaps by stop or less.
+	float Penetration(int a, int b, vec4 pa, vec4 pb, vec3& n, float stop = -1e30f) const {
+		vec3 ha = extents[a] * 0.5f, hb = extents[b] * 0.5f;
+		float dz = pb.z - pa.z;
+		float depth = ha.z + hb.z - fabsf(dz);
+		if (depth <= stop) return depth;
+		n = vec3(0, 0, dz < 0 ? -1.0f : 1.0f);
+		float sa, ca, sb, cb;
+		SinCos(pa.w, sa, ca);
+		SinCos(pb.w, sb, cb);
+		vec2 d(pb.x - pa.x, pb.y - pa.y), xa(ca, sa), ya(-sa, ca), xb(cb, sb), yb(-sb, cb);
+		for (vec2 u : { xa, ya, xb, yb }) {
+			float ra = ha.x * fabsf(dot(xa, u)) + ha.y * fabsf(dot(ya, u));
+			float rb = hb.x * fabsf(dot(xb, u)) + hb.y * fabsf(dot(yb, u));
+			float du = dot(d, u), overlap = ra + rb - fabsf(du);
+			if (overlap <= stop) return overlap;
+			if (overlap < depth) {
+				depth = overlap;
+				n = du < 0 ? vec3(-u.x, -u.y, 0) : vec3(u.x, u.y, 0);
+			}
+		}
+		return depth;
+	}
+
+	bool Overlap(int a, int b, vec4 pa, vec4 pb, Contact& contact) const { // separating axis test
+		vec3 n;
+		float depth = Penetration(a, b, pa, pb, n, 0);
+		if (depth <= 0) return false;
+		contact = { a, b, n, depth };
+		return true;
+	}
+
+	// First time of the step at which the boxes a and b, swept on straight lines, come within slop while approaching.
+	// Conservative advancement: the separation of Penetration shrinks by at most the relative move plus the radii
+	// times the turns over the step, so the boxes cannot touch before the sweep moved separation / that. No point
+	// moves more than half the thinnest side at a time, an overlap between two looks is refined by bisection.
+	// Pairs overlapping at the start are left to Overlap.
+	bool Impact(int a, int b, Contact& contact) const {
+		vec4 a0 = Start(a), b0 = Start(b), da = Pose(a) - a0, db = Pose(b) - b0;
+		vec3 move(db.x - da.x, db.y - da.y, db.z - da.z), n;
+		float rate = length(move) + radius[a] * fabsf(da.w) + radius[b] * fabsf(db.w);
+		if (rate <= 0) return false;
+		vec3 ea = extents[a], eb = extents[b];
+		float least = fminf(fminf(fminf(ea.x, ea.y), ea.z), fminf(fminf(eb.x, eb.y), eb.z)) / 2 / rate; // of the step
+		auto gapAt = [&](float t) { return -Penetration(a, b, a0 + da * t, b0 + db * t, n); };
+		float t = 0, gap = gapAt(0);
+		if (gap <= 0 || gap >= rate) return false; // overlapping already, or cannot close within the step
+		if (gap >= slop) {
+			float next = 0;
+			while (gap >= slop) {
+				if (next >= 1) return false;
+				t = next;
+				next = fminf(t + fmaxf(gap / rate, least), 1);
+				gap = gapAt(next);
+			}
+			for (int k = 0; k < 8; k++) { // t stays clear
+				float mid = (t + next) / 2;
+				if (gapAt(mid) < slop) next = mid;
+				else t = mid;
+			}
+			gap = gapAt(t);
+		}
+		if (dot(move, n) >= 0) return false; // leaving
+		contact = { a, b, n, -gap, t };
+		return true;
+	}
+
+	// Contacts of the cells that start in the sorted range begin .. end-1: the pairs within the cell and with the
+	// 13 neighboring cells that follow it in z, y, x order, so that every pair is tested once. The buckets of the
+	// neighbors are looked up once per cell, not per body.
+	void FindContacts(int begin, int end, std::vector<Contact>& out) const {
+		out.clear();
+		int n = Size(), first = begin;
+		while (first > 0 && first < end && SameCell(sorted[first - 1], sorted[first])) first++; // of the previous range
+		while (first < end) {
+			int last = first + 1;
+			while (last < n && SameCell(sorted[last], sorted[first])) last++;
+			for (int a = first; a < last; a++)
+				for (int b = a + 1; b < last; b++) Test(sorted[a], sorted[b], out);
+			const int * c = sorted[first].cell;
+			for (int offset = 14; offset < 27; offset++) { // (dx, dy, dz) after (0, 0, 0)
+				Slot neighbor;
+				neighbor.cell[0] = c[0] + offset % 3 - 1;
+				neighbor.cell[1] = c[1] + offset / 3 % 3 - 1;
+				neighbor.cell[2] = c[2] + offset / 9 - 1;
+				int bucket = Bucket(neighbor.cell[0], neighbor.cell[1], neighbor.cell[2]);
+				for (int slot = bucketStart[bucket]; slot < bucketStart[bucket + 1]; slot++) {
+					if (!SameCell(sorted[slot], neighbor)) continue; // another cell of the bucket
+					for (int a = first; a < last; a++) Test(sorted[a], sorted[slot], out);
+				}
+			}
+			first = last;
+		}
+	}
+
+	// A sleeper hit harder than resting contact does: its velocity changed by sleepSpeed or it was pushed beyond slop.
+	// Bodies still awake keep their rest time, so a crowd leaning on each other falls asleep too.
+	void Wake(int i, float dv, float dx) {
+		if (restTime[i] < sleepTime || (dv < sleepSpeed && dx < slop)) return;
+		restTime[i] = 0;
+		awake[i / chunkSize]++;
+	}
+
+	// Returns the number of bodies awake after the step, sleeping ones are stepped by 0 to stay vectorized
+	template<bool symplectic>
+	int Integrate(int begin, int end, float dt) {
+		float * __restrict x = &px[0], * __restrict y = &py[0], * __restrict z = &pz[0];
+		float * __restrict u = &vx[0], * __restrict v = &vy[0], * __restrict w = &vz[0];
+		float * __restrict phi = &angle[0], * __restrict om = &omega[0], * __restrict rest = &restTime[0];
+		const float * ax = &sx[0], * ay = &sy[0], * az = &sz[0], * l0 = &restLength[0], * D = &stiffness[0];
+		const float * im = &invMass[0], * ro = &drag[0], * h = &halfHeight[0], * kappa = &angularDrag[0], * iI = &invInertia[0];
+		const float gx = g.x, gy = g.y, gz = g.z;
+		const float slow2 = sleepAtRest ? sleepSpeed * sleepSpeed : -1;
+		int nAwake = 0;
+#pragma omp simd reduction(+:nAwake)
+		for (int i = begin; i < end; i++) {
+			float step = rest[i] < sleepTime ? dt : 0;
+			float s, c;
+			SinCos(phi[i], s, c);
+			float rx = h[i] * s, ry = -h[i] * c; // anchor on the body relative to its center, Body::Anchor
+			float dx = ax[i] - x[i] - rx, dy = ay[i] - y[i] - ry, dz = az[i] - z[i];
+			float r = sqrtf(dx * dx + dy * dy + dz * dz);
+			float k = D[i] * fmaxf(r - l0[i], 0.0f); // slack rope pulls nothing
+			float Kx = k * dx, Ky = k * dy, Kz = k * dz;
+			float ex = gx + (Kx - ro[i] * u[i]) * im[i];
+			float ey = gy + (Ky - ro[i] * v[i]) * im[i];
+			float ez = gz + (Kz - ro[i] * w[i]) * im[i];
+			float beta = (rx * Ky - ry * Kx - kappa[i] * om[i]) * iI[i];
+			if (symplectic) {
+				u[i] += ex * step; v[i] += ey * step; w[i] += ez * step; om[i] += beta * step;
+				x[i] += u[i] * step; y[i] += v[i] * step; z[i] += w[i] * step; phi[i] += om[i] * step;
+			} else {
+				x[i] += u[i] * step; y[i] += v[i] * step; z[i] += w[i] * step; phi[i] += om[i] * step;
+				u[i] += ex * step; v[i] += ey * step; w[i] += ez * step; om[i] += beta * step;
+			}
+			float speed2 = fmaxf(u[i] * u[i] + v[i] * v[i] + w[i] * w[i], om[i] * om[i]);
+			rest[i] = speed2 < slow2 ? rest[i] + step : 0;
+			float moving = rest[i] < sleepTime ? 1.0f : 0.0f; // falling asleep stops the body, like Body::Rest
+			u[i] *= moving; v[i] *= moving; w[i] *= moving; om[i] *= moving;
+			nAwake += rest[i] < sleepTime ? 1 : 0;
+		}
+		return nAwake;
+	}
+public:
+	Integration scheme = ExplicitEuler; // ExplicitEuler and SemiImplicitEuler are vectorized
+	StepPool * pool = nullptr;          // steps on the calling thread without
+	static constexpr int chunkSize = 1024; // fixed, so the results do not depend on the number of threads
+	std::vector<Contact> contacts;      // of the last Collide
+	float restitution = 0.2f, slop = 0.002f;
+	bool continuous = continuousCollision; // pairs are swept over the step, see Impact
+
+	int Size() const { return (int)px.size(); }
+
+	vec3 Extent(int i) const { return extents[i]; } // of the box of body i
+
+	// Copies the state and the parameters of a Body (rotating around z), the gravity is shared;
+	// the crowd is planar, a free Body enters with the twist of its q around z and its spin around z
+	int Add(const Body& body) {
+		BodyState st = body.State();
+		px.push_back(st.x.x); py.push_back(st.x.y); pz.push_back(st.x.z);
+		vx.push_back(st.v.x); vy.push_back(st.v.y); vz.push_back(st.v.z);
+		angle.push_back(st.angle); omega.push_back(st.omega);
+		sx.push_back(body.s.x); sy.push_back(body.s.y); sz.push_back(body.s.z);
+		restLength.push_back(body.l0); stiffness.push_back(body.D); invMass.push_back(1 / body.m); drag.push_back(body.ro);
+		halfHeight.push_back(body.scale.y / 2); angularDrag.push_back(body.kappa); invInertia.push_back(1 / body.Inertia());
+		restTime.push_back(0);
+		awake.assign((Size() + chunkSize - 1) / chunkSize, chunkSize);
+		ox.push_back(st.x.x); oy.push_back(st.x.y); oz.push_back(st.x.z); oangle.push_back(st.angle);
+		impact.push_back(1);
+		extents.push_back(body.scale);
+		radius.push_back(length(vec2(body.scale.x, body.scale.y)) / 2);
+		thinnest = fminf(thinnest, fminf(fminf(body.scale.x, body.scale.y), body.scale.z));
+		cellSize = vec3(fmaxf(cellSize.x, 2 * radius.back()), fmaxf(cellSize.y, 2 * radius.back()), fmaxf(cellSize.z, body.scale.z));
+		g = body.g;
+		return Size() - 1;
+	}
+
+	BodyState State(int i) const { return BodyState(vec3(px[i], py[i], pz[i]), vec3(vx[i], vy[i], vz[i]), angle[i], omega[i]); }
+
+	// Body::Launch of every jumper, each with its own stream
+	void Launch(CounterRNG rng, uint64_t jump) {
+		for (int i = 0; i < Size(); i++) {
+			CounterRNG own = rng.Stream(i);
+			vx[i] = own.Uniform(0.5f, 2.0f, jump, 0);
+			vy[i] = own.Uniform(0.0f, 1.0f, jump, 1);
+			vz[i] = 0;
+			restTime[i] = 0;
+		}
+		std::fill(awake.begin(), awake.end(), chunkSize);
+	}
+
+	int Step(int begin, int end, float dt) { // returns the bodies awake after the step
+		if (scheme == SemiImplicitEuler) return Integrate<true>(begin, end, dt);
+		else return Integrate<false>(begin, end, dt);
+	}
+
+	void Step(float dt) { // bodies are independent, every one is stepped by the same code in any chunk
+		int nChunks = (Size() + chunkSize - 1) / chunkSize;
+		auto chunk = [this, dt](int c) {
+			if (awake[c] == 0) return;
+			int begin = c * chunkSize, end = std::min((c + 1) * chunkSize, Size());
+			if (continuous) Save(begin, end);
+			awake[c] = Step(begin, end, dt);
+		};
+		if (pool && nChunks > 1) pool->Run(nChunks, chunk);
+		else for (int c = 0; c < nChunks; c++) chunk(c);
+	}
+
+	// Contacts of all the overlapping pairs into contacts, in the same order for any number of threads
+	int FindContacts() {
+		BuildGrid();
+		int nChunks = (Size() + chunkSize - 1) / chunkSize;
+		chunkContacts.resize(nChunks);
+		auto chunk = [this](int c) { FindContacts(c * chunkSize, std::min((c + 1) * chunkSize, Size()), chunkContacts[c]); };
+		if (pool && nChunks > 1) pool->Run(nChunks, chunk);
+		else for (int c = 0; c < nChunks; c++) chunk(c);
+		contacts.clear();
+		for (const std::vector<Contact>& found : chunkContacts) contacts.insert(contacts.end(), found.begin(), found.end());
+		return (int)contacts.size();
+	}
+
+	// Moves the bodies of the swept contacts back along their step to their earliest time of impact
+	void Rewind() {
+		rewound.clear();
+		for (const Contact& c : contacts) {
+			if (c.time >= 1) continue;
+			for (int i : { c.a, c.b }) {
+				if (impact[i] == 1) rewound.push_back(i);
+				impact[i] = fminf(impact[i], c.time);
+			}
+		}
+		for (int i : rewound) {
+			vec4 p = Start(i) + (Pose(i) - Start(i)) * impact[i];
+			px[i] = p.x; py[i] = p.y; pz[i] = p.z; angle[i] = p.w;
+			impact[i] = 1;
+		}
+	}
+
+	// Pushes the overlapping boxes apart after a step: an impulse through the centers stops the approach,
+	// the penetration beyond slop is removed in proportion to the inverse masses; sleepers only wake when hit, see Wake.
+	// Swept boxes are stopped at their time of impact first, their contacts only take the impulse.
+	void Collide() {
+		FindContacts();
+		if (continuous) Rewind();
+		for (const Contact& c : contacts) {
+			int a = c.a, b = c.b;
+			float wa = invMass[a], wb = invMass[b];
+			float vn = (vx[b] - vx[a]) * c.n.x + (vy[b] - vy[a]) * c.n.y + (vz[b] - vz[a]) * c.n.z;
+			float push = fmaxf(c.depth - slop, 0) / (wa + wb);
+			if (vn >= 0 && push == 0) continue;
+			float j = vn < 0 ? -(1 + restitution) * vn / (wa + wb) : 0;
+			if (j > 0) {
+				vx[a] -= c.n.x * j * wa; vy[a] -= c.n.y * j * wa; vz[a] -= c.n.z * j * wa;
+				vx[b] += c.n.x * j * wb; vy[b] += c.n.y * j * wb; vz[b] += c.n.z * j * wb;
+			}
+			px[a] -= c.n.x * push * wa; py[a] -= c.n.y * push * wa; pz[a] -= c.n.z * push * wa;
+			px[b] += c.n.x * push * wb; py[b] += c.n.y * push * wb; pz[b] += c.n.z * push * wb;
+			Wake(a, j * wa, push * wa);
+			Wake(b, j * wb, push * wb);
+		}
+	}
+
+	// All pairs without the broadphase, for the benchmark
+	int FindContactsBruteForce() {
+		contacts.clear();
+		for (int i = 0; i < Size(); i++) {
+			for (int j = i + 1; j < Size(); j++) {
+				Contact contact;
+				if (Overlap(i, j, vec4(px[i], py[i], pz[i], angle[i]), vec4(px[j], py[j], pz[j], angle[j]), contact))
+					contacts.push_back(contact);
+			}
+		}
+		return (int)contacts.size();
+	}
+
+	void Animate(float tstart, float tend) { // one step of the bodies awake, then their contacts
+		if (!goon) return;
+		Step(tend - tstart);
+		if (crowdCollisions && !Asleep()) Collide();
+	}
+
+	bool Asleep() const { // every body fell asleep after the launch
+		if (!goon) return false;
+		for (int n : awake) if (n > 0) return false;
+		return true;
+	}
+
+	void Publish(std::vector<vec4>& out) const { // position and angle of the bodies
+		out.resize(Size());
+		for (int i = 0; i < Size(); i++) out[i] = vec4(px[i], py[i], pz[i], angle[i]);
+	}
+};
+
+// Normals transform with the inverse transpose, like in the shaders
+inline vec3 NormalToWorld(const mat4& Minv, vec3 n) {
+	return vec3(dot(vec3(Minv[0].x, Minv[0].y, Minv[0].z), n), dot(vec3(Minv[1].x, Minv[1].y, Minv[1].z), n),
+	            dot(vec3(Minv[2].x, Minv[2].y, Minv[2].z), n));
+}
+
+//---------------------------
+class HeightField { // world-space height and normal grid of a terrain object for constant cost ground queries
+//---------------------------
+	int res = 0;                // cells per axis, (res + 1)^2 nodes
+	std::vector<float> heights; // world y of the nodes
+	std::vector<vec3> normals;  // world normals of the nodes
+	mat4 Minv;                  // world -> modeling space, the terrain may only be rotated about the y axis
+	float cellSize = 1;         // smallest world edge of a cell, the ray marching step
+
+	float H(int i, int j) const { // row i (v), column j (u), clamped to the edge
+		i = i < 0 ? 0 : (i > res ? res : i);
+		j = j < 0 ? 0 : (j > res ? res : j);
+		return heights[i * (res + 1) + j];
+	}
+
+	float HExtrapolated(int i, int j) const { // one node beyond the edge is extrapolated linearly for the cubic stencil
+		if (i == -1) return 2 * HExtrapolated(0, j) - HExtrapolated(1, j);
+		if (i == res + 1) return 2 * HExtrapolated(res, j) - HExtrapolated(res - 1, j);
+		if (j == -1) return 2 * H(i, 0) - H(i, 1);
+		if (j == res + 1) return 2 * H(i, res) - H(i, res - 1);
+		return H(i, j);
+	}
+
+	vec3 N(int i, int j) const {
+		i = i < 0 ? 0 : (i > res ? res : i);
+		j = j < 0 ? 0 : (j > res ? res : j);
+		return normals[i * (res + 1) + j];
+	}
+
+	vec2 GridCoords(float x, float z) const { // world (x, z) -> continuous (column, row)
+		vec4 p = vec4(x, 0, z, 1) * Minv;
+		return vec2((p.x + 0.5f) * res, (p.z + 0.5f) * res);
+	}
+
+	static void CatmullRom(float t, float w[4], float dw[4]) { // weights and their derivatives
+		float t2 = t * t, t3 = t2 * t;
+		w[0] = (-t3 + 2 * t2 - t) / 2;     dw[0] = (-3 * t2 + 4 * t - 1) / 2;
+		w[1] = (3 * t3 - 5 * t2 + 2) / 2;  dw[1] = (9 * t2 - 10 * t) / 2;
+		w[2] = (-3 * t3 + 4 * t2 + t) / 2; dw[2] = (-9 * t2 + 8 * t + 1) / 2;
+		w[3] = (t3 - t2) / 2;              dw[3] = (3 * t2 - 2 * t) / 2;
+	}
+
+	// Bicubic height with its derivatives along the grid column and row directions
+	float SampleBicubic(vec2 g, float& dhdu, float& dhdv) const {
+		int j = (int)floorf(g.x), i = (int)floorf(g.y);
+		float wu[4], dwu[4], wv[4], dwv[4];
+		CatmullRom(g.x - j, wu, dwu);
+		CatmullRom(g.y - i, wv, dwv);
+		float h = 0;
+		dhdu = dhdv = 0;
+		for (int r = 0; r < 4; r++) {
+			float row = 0, drow = 0;
+			for (int c = 0; c < 4; c++) {
+				float hc = HExtrapolated(i - 1 + r, j - 1 + c);
+				row += wu[c] * hc;
+				drow += dwu[c] * hc;
+			}
+			h += wv[r] * row;
+			dhdu += wv[r] * drow;
+			dhdv += dwv[r] * row;
+		}
+		return h;
+	}
+
+	// Rows i0..i1 and columns j0..j1 of the nodes under the world space rectangle, with a node of margin
+	void Nodes(float x0, float z0, float x1, float z1, int& i0, int& i1, int& j0, int& j1) const {
+		vec2 a = GridCoords(x0, z0), b = GridCoords(x1, z0), c = GridCoords(x0, z1), d = GridCoords(x1, z1);
+		j0 = (int)floorf(fminf(fminf(a.x, b.x), fminf(c.x, d.x))), j1 = (int)ceilf(fmaxf(fmaxf(a.x, b.x), fmaxf(c.x, d.x)));
+		i0 = (int)floorf(fminf(fminf(a.y, b.y), fminf(c.y, d.y))), i1 = (int)ceilf(fmaxf(fmaxf(a.y, b.y), fmaxf(c.y, d.y)));
+		auto clamp = [this](int k) { return k < 0 ? 0 : (k > res ? res : k); }; // off the grid the edge continues, like H
+		i0 = clamp(i0); i1 = clamp(i1); j0 = clamp(j0); j1 = clamp(j1);
+	}
+
+	float Slope(int i0, int i1, int j0, int j1) const { // of the cells from the nodes i0..i1, j0..j1, see MaxSlope
+		float d = 0;
+		for (int i = i0; i <= i1; i++)
+			for (int j = j0; j <= j1; j++) d = fmaxf(d, fmaxf(fabsf(H(i, j + 1) - H(i, j)), fabsf(H(i + 1, j) - H(i, j))));
+		return sqrtf(2.0f) * d / cellSize;
+	}
+public:
+	enum Filter { Bilinear, Bicubic };
+
+	// Samples the surface on a res x res grid (through its fast grid path) and moves it to world space
+	void Build(ParamSurface * surface, Placement * object, int resolution = 256) {
+		res = resolution;
+		mat4 M;
+		object->SetModelingTransform(M, Minv);
+		std::vector<ParamSurface::VertexData> grid((res + 1) * (res + 1));
+		surface->GenGrid(res, res, grid);
+		heights.resize(grid.size());
+		normals.resize(grid.size());
+		for (size_t k = 0; k < grid.size(); k++) {
+			heights[k] = (vec4(grid[k].position.x, grid[k].position.y, grid[k].position.z, 1) * M).y;
+			vec3 wn = NormalToWorld(Minv, grid[k].normal);
+			normals[k] = normalize(wn.y < 0 ? -wn : wn);
+		}
+		vec4 du = vec4(1, 0, 0, 0) * M, dv = vec4(0, 0, 1, 0) * M;
+		cellSize = fminf(length(vec3(du.x, du.y, du.z)), length(vec3(dv.x, dv.y, dv.z))) / res;
+	}
+
+	// Highest node in the world space rectangle (with a node of margin), the broadphase of collisions
+	float MaxHeight(float x0, float z0, float x1, float z1) const {
+		int i0, i1, j0, j1;
+		Nodes(x0, z0, x1, z1, i0, i1, j0, j1);
+		float h = -1e30f;
+		for (int i = i0; i <= i1; i++)
+			for (int j = j0; j <= j1; j++) h = fmaxf(h, heights[i * (res + 1) + j]);
+		return h;
+	}
+
+	float CellSize() const { return cellSize; }
+
+	float MaxSlope() const { return Slope(0, res, 0, res); } // bound of the height change per world unit of the bilinear Height
+
+	float MaxSlope(float x0, float z0, float x1, float z1) const { // the same bound over the world space rectangle
+		int i0, i1, j0, j1;
+		Nodes(x0, z0, x1, z1, i0, i1, j0, j1);
+		return Slope(i0, i1, j0, j1);
+	}
+
+	float Height(float x, float z, Filter filter = Bilinear) const {
+		vec2 g = GridCoords(x, z);
+		if (filter == Bicubic) {
+			float dhdu, dhdv;
+			return SampleBicubic(g, dhdu, dhdv);
+		}
+		int j = (int)floorf(g.x), i = (int)floorf(g.y);
+		float fu = g.x - j, fv = g.y - i;
+		return (H(i, j) * (1 - fu) + H(i, j + 1) * fu) * (1 - fv) + (H(i + 1, j) * (1 - fu) + H(i + 1, j + 1) * fu) * fv;
+	}
+
+	vec3 Normal(float x, float z, Filter filter = Bilinear) const {
+		vec2 g = GridCoords(x, z);
+		if (filter == Bicubic) { // gradient of the bicubic patch, chained through world -> grid mapping
+			float dhdu, dhdv;
+			SampleBicubic(g, dhdu, dhdv);
+			float dhdx = res * (dhdu * Minv[0].x + dhdv * Minv[0].z), dhdz = res * (dhdu * Minv[2].x + dhdv * Minv[2].z);
+			return normalize(vec3(-dhdx, 1, -dhdz));
+		}
+		int j = (int)floorf(g.x), i = (int)floorf(g.y);
+		float fu = g.x - j, fv = g.y - i;
+		return normalize((N(i, j) * (1 - fu) + N(i, j + 1) * fu) * (1 - fv) + (N(i + 1, j) * (1 - fu) + N(i + 1, j + 1) * fu) * fv);
+	}
+
+	// First crossing of the ray with the ground within tmax, marched by half cells and refined by bisection
+	bool Intersect(vec3 origin, vec3 dir, float& t, float tmax = 100, Filter filter = Bilinear) const {
+		dir = normalize(dir);
+		float step = cellSize / 2, tprev = 0;
+		float fprev = origin.y - Height(origin.x, origin.z, filter);
+		if (fprev < 0) { t = 0; return true; }
+		for (float tcur = step; tcur <= tmax + step; tcur += step) {
+			tcur = fminf(tcur, tmax);
+			vec3 p = origin + dir * tcur;
+			float f = p.y - Height(p.x, p.z, filter);
+			if (f < 0) {
+				float t0 = tprev, t1 = tcur;
+				for (int k = 0; k < 16; k++) {
+					float tm = (t0 + t1) / 2;
+					vec3 pm = origin + dir * tm;
+					if (pm.y - Height(pm.x, pm.z, filter) < 0) t1 = tm; else t0 = tm;
+				}
+				t = (t0 + t1) / 2;
+				return true;
+			}
+			if (tcur >= tmax) break;
+			tprev = tcur;
+		}
+		return false;
+	}
+
+	// Batched queries, xz[k] = (x, z) in world space
+	void Heights(const std::vector<vec2>& xz, std::vector<float>& out, Filter filter = Bilinear) const {
+		out.resize(xz.size());
+#pragma omp parallel for
+		for (int k = 0; k < (int)xz.size(); k++) out[k] = Height(xz[k].x, xz[k].y, filter);
+	}
+
+	void Normals(const std::vector<vec2>& xz, std::vector<vec3>& out, Filter filter = Bilinear) const {
+		out.resize(xz.size());
+#pragma omp parallel for
+		for (int k = 0; k < (int)xz.size(); k++) out[k] = Normal(xz[k].x, xz[k].y, filter);
+	}
+};
+
+//---------------------------
+class HeightQuadtree { // terrain chunks in a quadtree: world bounds, height ranges and errors, for culling and range queries
+//---------------------------
+public:
+	struct Node {
+		vec2 uv0, uv1;        // parameter rectangle
+		int i0, j0, stride;   // first fine sample of the chunk and its sample spacing
+		float hmin, hmax;     // world height range
+		vec3 bmin, bmax;      // world bounding box
+		float error;          // largest world space height error of the chunk against the finest samples
+		Node * children[4];   // nullptr at leaves
+	};
+private:
+	std::vector<Node> nodes; // preorder, reserved up front so the children pointers stay valid
+	int chunkRes, depth;     // cells per chunk edge, levels below the root
+	int fineRes;             // chunkRes * 2^depth
+	std::vector<ParamSurface::VertexData> fine; // (fineRes + 1)^2 modeling space samples, every chunk is a subsampling of it
+
+	Node * BuildNode(int d, int i0, int j0, const mat4& M) {
+		int stride = 1 << (depth - d), cells = chunkRes * stride;
+		nodes.emplace_back();
+		Node * node = &nodes.back();
+		node->uv0 = vec2((float)j0 / fineRes, (float)i0 / fineRes);
+		node->uv1 = vec2((float)(j0 + cells) / fineRes, (float)(i0 + cells) / fineRes);
+		node->i0 = i0;
+		node->j0 = j0;
+		node->stride = stride;
+		float hmin = 1e30f, hmax = -1e30f, error = 0;
+		for (int i = i0; i <= i0 + cells; i++) {
+			for (int j = j0; j <= j0 + cells; j++) {
+				float h = Fine(i, j).position.y;
+				hmin = fminf(hmin, h);
+				hmax = fmaxf(hmax, h);
+				int ci = i0 + (i - i0) / stride * stride, cj = j0 + (j - j0) / stride * stride; // chunk cell corner
+				float fi = (float)(i - ci) / stride, fj = (float)(j - cj) / stride;
+				int ci1 = std::min(ci + stride, i0 + cells), cj1 = std::min(cj + stride, j0 + cells);
+				float approx = (Fine(ci, cj).position.y * (1 - fj) + Fine(ci, cj1).position.y * fj) * (1 - fi) +
+				               (Fine(ci1, cj).position.y * (1 - fj) + Fine(ci1, cj1).position.y * fj) * fi;
+				error = fmaxf(error, fabsf(h - approx));
+			}
+		}
+		node->bmin = vec3(1e30f, 1e30f, 1e30f);
+		node->bmax = -node->bmin;
+		for (int k = 0; k < 8; k++) {
+			vec4 c = vec4((k & 1 ? node->uv1.x : node->uv0.x) - 0.5f, k & 2 ? hmax : hmin, (k & 4 ? node->uv1.y : node->uv0.y) - 0.5f, 1) * M;
+			node->bmin = vec3(fminf(node->bmin.x, c.x), fminf(node->bmin.y, c.y), fminf(node->bmin.z, c.z));
+			node->bmax = vec3(fmaxf(node->bmax.x, c.x), fmaxf(node->bmax.y, c.y), fmaxf(node->bmax.z, c.z));
+		}
+		node->hmin = node->bmin.y;
+		node->hmax = node->bmax.y;
+		node->error = error * length(vec3(M[1].x, M[1].y, M[1].z));
+
+		for (int k = 0; k < 4; k++) node->children[k] = nullptr;
+		if (d < depth) {
+			int half = cells / 2;
+			for (int k = 0; k < 4; k++) node->children[k] = BuildNode(d + 1, i0 + (k / 2) * half, j0 + (k % 2) * half, M);
+		}
+		return node;
+	}
+
+	void CollectLeaves(const Node * node, vec3 lo, vec3 hi, std::vector<const Node *>& result) const {
+		if (node->bmax.x < lo.x || node->bmin.x > hi.x || node->bmax.y < lo.y || node->bmin.y > hi.y ||
+			node->bmax.z < lo.z || node->bmin.z > hi.z) return;
+		if (!node->children[0]) { result.push_back(node); return; }
+		for (const Node * child : node->children) CollectLeaves(child, lo, hi, result);
+	}
+public:
+	HeightQuadtree(int _chunkRes = 16, int _depth = 4) {
+		chunkRes = _chunkRes;
+		depth = _depth;
+		fineRes = chunkRes << depth;
+	}
+
+	// Samples the surface once at the finest resolution and bounds the chunks in the world of the object
+	void Build(ParamSurface * surface, Placement * object) {
+		mat4 M, Minv;
+		object->SetModelingTransform(M, Minv);
+		fine.resize((fineRes + 1) * (fineRes + 1));
+		surface->GenGrid(fineRes, fineRes, fine);
+		nodes.clear();
+		nodes.reserve((((size_t)1 << (2 * depth + 2)) - 1) / 3); // 1 + 4 + .. + 4^depth
+		BuildNode(0, 0, 0, M);
+	}
+
+	const ParamSurface::VertexData& Fine(int i, int j) const { return fine[i * (fineRes + 1) + j]; }
+	int FineRes() const { return fineRes; }
+	int ChunkRes() const { return chunkRes; }
+	const Node * Root() const { return nodes.empty() ? nullptr : &nodes[0]; }
+	int Index(const Node * node) const { return (int)(node - &nodes[0]); } // preorder, for what a user keeps per chunk
+	int Size() const { return (int)nodes.size(); }
+
+	// Leaves whose world bounding box overlaps [lo, hi]
+	void Query(vec3 lo, vec3 hi, std::vector<const Node *>& result) const {
+		result.clear();
+		if (!nodes.empty()) CollectLeaves(Root(), lo, hi, result);
+	}
+
+	// Conservative ground height range over the world rectangle [x0, x1] x [z0, z1]
+	bool HeightRange(float x0, float z0, float x1, float z1, float& hmin, float& hmax) const {
+		std::vector<const Node *> leaves;
+		Query(vec3(x0, -1e30f, z0), vec3(x1, 1e30f, z1), leaves);
+		hmin = 1e30f; hmax = -1e30f;
+		for (const Node * leaf : leaves) { hmin = fminf(hmin, leaf->hmin); hmax = fmaxf(hmax, leaf->hmax); }
+		return !leaves.empty();
+	}
+};
+
+//---------------------------
+class TerrainCollider { // box of a Body against a HeightField, sequential impulses with Coulomb friction
+//---------------------------
+	struct Contact {
+		vec3 p, n;   // world point of the box below the surface and the surface normal there
+		float depth; // along n
+		float bias;  // normal velocity to reach, restitution
+		float jn;    // accumulated normal impulse
+		vec3 jt;     // accumulated friction impulse
+	};
+	std::vector<Contact> contacts;
+
+	static const int nSamples = 44; // points of the box tested against the ground
+
+	// Each corner followed by three points on each of its edges towards the corners with one more coordinate set,
+	// with the bounds of the box
+	static void Samples(const mat4& M, vec3 samples[nSamples], vec3& lo, vec3& hi) {
+		vec3 corners[8];
+		lo = vec3(1e30f, 1e30f, 1e30f);
+		hi = vec3(-1e30f, -1e30f, -1e30f);
+		for (int k = 0; k < 8; k++) {
+			vec4 c = vec4((k & 1) - 0.5f, ((k >> 1) & 1) - 0.5f, ((k >> 2) & 1) - 0.5f, 1) * M;
+			corners[k] = vec3(c.x, c.y, c.z);
+			lo = vec3(fminf(lo.x, c.x), fminf(lo.y, c.y), fminf(lo.z, c.z));
+			hi = vec3(fmaxf(hi.x, c.x), fmaxf(hi.y, c.y), fmaxf(hi.z, c.z));
+		}
+		int s = 0;
+		for (int k = 0; k < 8; k++) {
+			samples[s++] = corners[k];
+			for (int axis = 1; axis < 8; axis <<= 1) {
+				if (k & axis) continue;
+				for (float t : { 0.25f, 0.5f, 0.75f }) samples[s++] = corners[k] * (1 - t) + corners[k | axis] * t;
+			}
+		}
+	}
+public:
+	float restitution = 0.2f, friction = 0.6f, slop = 0.002f;
+	int iterations = 4;
+	int maxImpacts = 4;                    // per step, see Collide
+	bool continuous = continuousCollision; // Sweep before Resolve
+	long queries = 0; // height field lookups
+
+	// Moves the body back along its last step to where its box first came within slop of the ground, returns the
+	// fraction of the step kept, 1 without impact. Conservative advancement over the straight sweep from the previous
+	// pose: no sample moves more than the center plus radius times the turn, so a sample g above the ground cannot
+	// reach it before the sweep moved g / ((1 + slope) * that), with the slope bound of the cells below the sweep.
+	// Close above the ground that would crawl, so the sweep advances half a cell at least, like Intersect, and a
+	// crossing found is refined by bisection. Samples already touching at the start, and bodies moving less than
+	// half a cell, are left to Resolve.
+	float Sweep(Body& body, const HeightField& field) {
+		BodyPose from = body.PrevPose(), to = body.Pose();
+		float turn = body.free3D ? 2 * acosf(fminf(fabsf(dot(from.q, to.q)), 1)) : fabsf(to.rotationAngle - from.rotationAngle);
+		if (body.free3D) turn /= fmaxf(cosf(turn / 2), 1e-3f); // nlerp turns at most that much faster than uniformly
+		float bulge = length(body.scale) / 2 * turn; // off the straight line between the two poses
+		float path = length(to.translation - from.translation) + bulge;
+		if (path < field.CellSize() / 2) return 1; // no sample can skip a cell, Resolve sees every crossing
+
+		mat4 M, Minv;
+		vec3 samples[nSamples], lo, hi, lo1, hi1;
+		body.Transform(to, M, Minv);
+		Samples(M, samples, lo1, hi1);
+		body.Transform(from, M, Minv);
+		Samples(M, samples, lo, hi);
+		lo = vec3(fminf(lo.x, lo1.x), fminf(lo.y, lo1.y), fminf(lo.z, lo1.z)) - vec3(bulge, bulge, bulge);
+		hi = vec3(fmaxf(hi.x, hi1.x), fmaxf(hi.y, hi1.y), fmaxf(hi.z, hi1.z)) + vec3(bulge, bulge, bulge);
+		if (lo.y > field.MaxHeight(lo.x, lo.z, hi.x, hi.z)) return 1; // the sweep stays above every cell below it
+		float rate = path * (1 + field.MaxSlope(lo.x, lo.z, hi.x, hi.z)), least = field.CellSize() / 2 / path;
+
+		bool airborne[nSamples];
+		float gap = 1e30f;
+		for (int k = 0; k < nSamples; k++) {
+			float g = samples[k].y - field.Height(samples[k].x, samples[k].z);
+			queries++;
+			airborne[k] = g >= slop;
+			if (airborne[k]) gap = fminf(gap, g);
+		}
+		if (gap >= rate) return 1; // cannot close within the step, also without airborne samples
+		auto gapAt = [&](float s) { // of the airborne samples s of the way
+			body.Transform(from.Lerp(to, s), M, Minv);
+			Samples(M, samples, lo1, hi1);
+			float g = 1e30f;
+			for (int k = 0; k < nSamples; k++) {
+				if (!airborne[k]) continue;
+				g = fminf(g, samples[k].y - field.Height(samples[k].x, samples[k].z));
+				queries++;
+			}
+			return g;
+		};
+		float s = 0;
+		while (s < 1) {
+			float next = fminf(s + fmaxf(gap / rate, least), 1);
+			gap = gapAt(next);
+			if (gap >= slop) {
+				s = next;
+				continue;
+			}
+			for (int k = 0; k < 8; k++) { // s stays clear
+				float mid = (s + next) / 2;
+				if (gapAt(mid) < slop) next = mid;
+				else s = mid;
+			}
+			body.Place(from.Lerp(to, s));
+			return s;
+		}
+		return 1;
+	}
+
+	// Resolves the penetration of the box after a step, returns the number of contact points. Samples less than
+	// margin above the ground are contacts too, they only stop the approach.
+	int Resolve(Body& body, const HeightField& field, float margin = 0) {
+		mat4 M, Minv;
+		body.SetModelingTransform(M, Minv);
+		vec3 samples[nSamples], lo, hi;
+		Samples(M, samples, lo, hi);
+		if (lo.y - margin > field.MaxHeight(lo.x, lo.z, hi.x, hi.z)) return 0; // above every cell under the box
+
+		contacts.clear();
+		for (const vec3& p : samples) {
+			float h = field.Height(p.x, p.z);
+			queries++;
+			if (p.y >= h + margin) continue;
+			vec3 n = field.Normal(p.x, p.z);
+			float vn = dot(body.VelocityAt(p), n);
+			contacts.push_back({ p, n, (h - p.y) * n.y, vn < -1 ? -restitution * vn : 0, 0, vec3(0, 0, 0) });
+		}
+		if (contacts.empty()) return 0;
+
+		for (int it = 0; it < iterations; it++) {
+			for (Contact& c : contacts) {
+				float vn = dot(body.VelocityAt(c.p), c.n);
+				float jn = fmaxf(c.jn + (c.bias - vn) / body.InverseMassAt(c.p, c.n), 0);
+				body.ApplyImpulse(c.p, c.n * (jn - c.jn));
+				c.jn = jn;
+
+				vec3 vt = body.VelocityAt(c.p);
+				vt = vt - c.n * dot(vt, c.n);
+				if (length(vt) < 1e-6f) continue;
+				vec3 t = normalize(vt);
+				vec3 jt = c.jt - t * (length(vt) / body.InverseMassAt(c.p, t));
+				if (length(jt) > friction * c.jn) jt = jt * (friction * c.jn / length(jt)); // static cone
+				body.ApplyImpulse(c.p, jt - c.jt);
+				c.jt = jt;
+			}
+		}
+		vec3 push(0, 0, 0); // positional correction, each contact projected out in turn, so all of them are left
+		for (int it = 0; it < iterations; it++) {
+			for (const Contact& c : contacts) {
+				float left = c.depth - slop - dot(push, c.n);
+				if (left > 0) push = push + c.n * left;
+			}
+		}
+		body.translation = body.translation + push;
+		return (int)contacts.size();
+	}
+
+	// After a step of the body by dt: stopped at the time of impact by the sweep, the contacts there resolved, then
+	// the rest of the step moved from the impact and swept again. The time left after maxImpacts impacts in one step
+	// is dropped. The rope pulls again from the next step on.
+	int Collide(Body& body, const HeightField& field, float dt) {
+		BodyPose start = body.PrevPose();
+		int n;
+		for (int impact = 0; ; impact++) {
+			float kept = continuous ? Sweep(body, field) : 1;
+			n = Resolve(body, field, kept < 1 ? 2 * slop : 0);
+			if (kept >= 1 || impact == maxImpacts) break;
+			dt *= 1 - kept;
+			body.Settle(); // the rest of the step is swept from here
+			body.Move(dt);
+		}
+		body.Settle(start); // the frames still interpolate over the whole step
+		return n;
+	}
+};
+
+//---------------------------
+class PhysicsProbe { // the latest ProbeSamples of the jumper in a ring allocated before the simulation starts
+//---------------------------
+	// Binary, native byte order: "JMPP", version, number of floats per sample, number of samples,
+	// then per sample the time as double and kinetic, potential, elastic, extension, tension, torque, omega as floats
+	static constexpr uint16_t version = 1;
+	std::vector<ProbeSample> ring;
+	long count = 0;       // recorded so far, the last ring.size() of them are kept
+	float lowest = 1e30f; // energy since the launch, damping and collisions only take from it
+	bool warned = false;
+	std::atomic<const char *> request{ nullptr }; // path to write to, set by any thread
+
+	bool WriteCSV(const char * path) const {
+		FILE * file = fopen(path, "w");
+		if (!file) return false;
+		fprintf(file, "time,kinetic,potential,elastic,energy,extension,tension,torque,omega\n");
+		for (long i = 0; i < Size(); i++) {
+			const ProbeSample& p = (*this)[i];
+			fprintf(file, "%.4f,%g,%g,%g,%g,%g,%g,%g,%g\n", p.time, p.kinetic, p.potential, p.elastic, p.Energy(),
+			        p.extension, p.tension, p.torque, p.omega);
+		}
+		return fclose(file) == 0;
+	}
+
+	bool WriteBinary(const char * path) const {
+		FILE * file = fopen(path, "wb");
+		if (!file) return false;
+		uint16_t nFloats = 7;
+		uint64_t n = Size();
+		fwrite("JMPP", 1, 4, file);
+		fwrite(&version, sizeof(version), 1, file);
+		fwrite(&nFloats, sizeof(nFloats), 1, file);
+		fwrite(&n, sizeof(n), 1, file);
+		for (long i = 0; i < Size(); i++) {
+			const ProbeSample& p = (*this)[i];
+			float values[] = { p.kinetic, p.potential, p.elastic, p.extension, p.tension, p.torque, p.omega };
+			fwrite(&p.time, sizeof(p.time), 1, file);
+			fwrite(values, sizeof(float), nFloats, file);
+		}
+		return fclose(file) == 0;
+	}
+public:
+	float gainTolerance = 0.05f; // J, energy gain over the lowest seen that is reported as an integrator blow-up
+
+	void Allocate(int capacity) { ring.assign(capacity, ProbeSample()); }
+
+	void Record(const ProbeSample& p) {
+		if (ring.empty()) return;
+		ring[count++ % ring.size()] = p;
+		lowest = fminf(lowest, p.Energy());
+		if (!warned && p.Energy() > lowest + gainTolerance) {
+			printf("energy gained %.3f J at %.3f s without a source, the integrator is unstable at this step\n",
+			       p.Energy() - lowest, p.time);
+			warned = true;
+		}
+	}
+
+	long Size() const { return std::min(count, (long)ring.size()); }
+
+	const ProbeSample& operator[](long i) const { return ring[(count - Size() + i) % ring.size()]; } // 0: oldest kept
+
+	bool Write(const char * path) const { // binary if the name ends with .bin, CSV otherwise
+		size_t len = strlen(path);
+		return len > 4 && strcmp(path + len - 4, ".bin") == 0 ? WriteBinary(path) : WriteCSV(path);
+	}
+
+	void Request(const char * path) { request = path; } // written by the next Serve, path must outlive it
+
+	void Serve() { // on the thread that records, between steps
+		const char * path = request.exchange(nullptr);
+		if (!path) return;
+		if (Write(path)) printf("%ld steps of the jumper written to %s\n", Size(), path);
+		else printf("cannot write %s\n", path);
+	}
+};
+
+//---------------------------
+struct SceneSnapshot { // what the frames draw of a physics step
+//---------------------------
+	double time = 0;         // simulated time of the step
+	double dropped = 0;      // real time the simulation skipped to keep up, see SimulationClock
+	BodyPose prev, cur;      // the jumper before and after the step
+	std::vector<vec3> rope;  // particles
+	std::vector<vec4> crowd; // position and angle of the bodies
+	bool resting = false;    // every body sleeps, see sleepAtRest
+};
+
+//---------------------------
+class World { // what the physics steps: the jumper, its rope and the crowd over the height field of the terrain
+//---------------------------
+	Body * b;
+public:
+	HeightField heightField; // ground queries for physics and camera placement
+	TerrainCollider collider;
+	BodySystem * crowd = nullptr;
+	PhysicsProbe probe;      // of the jumper, with instrumentPhysics
+	Body parameters;         // D, l0, m, ro and kappa of the jumpers, see SessionLog::Replay
+	int32_t jumps = 0;       // launches so far: the next one draws from the streams of this jump, see SessionLog::Replay
+
+	static void PlaceTerrain(Placement& terrain) { // the surface of the terrain in the world, for the window and jumpsim
+		terrain.translation = vec3(0, -5, 0);
+		terrain.scale = vec3(15, 1, 15);
+		terrain.rotationAxis = vec3(0, 1, 0);
+	}
+
+	void Build(ParamSurface * surface, Placement * terrain) {
+		heightField.Build(surface, terrain); // a snapshot: the animated terrain only moves on the GPU
+		BuildBodies();
+	}
+
+	// Without a window: the terrain only feeds the height field
+	void Build() {
+		ParamSurface * noise = fftTerrain ? (ParamSurface *)new FFTNoise() : new Noise(); // the surface of Scene::Build
+		Placement terrain;
+		PlaceTerrain(terrain);
+		Build(noise, &terrain);
+		delete noise;
+	}
+
+	// The simulated objects: the jumper, its rope and the crowd
+	void BuildBodies() {
+		b = new Body();
+		b->Configure(parameters);
+		b->translation = vec3(0, 5, 0);
+		b->scale = vec3(1, 1.5, 0.5);
+		b->Settle();
+		if (instrumentPhysics) probe.Allocate(probeCapacity);
+
+		if (ropeSegments > 0) {
+			// the spring pulls with D r (r - l0), its slope at the rest length is D l0
+			b->rope = new Rope(b->s, b->AttachmentPoint(), b->l0, ropeSegments, b->D * b->l0);
+		}
+
+		if (crowdSize > 0) { // jumpers on a grid above the terrain, each hanging from its own anchor
+			crowd = new BodySystem();
+			crowd->pool = new StepPool(physicsThreads > 0 ? physicsThreads : std::thread::hardware_concurrency());
+			int side = (int)ceilf(sqrtf((float)crowdSize));
+			Body jumper;
+			jumper.Configure(parameters);
+			jumper.scale = vec3(0.2f, 0.3f, 0.1f);
+			for (int i = 0; i < crowdSize; i++) {
+				jumper.translation = jumper.s = vec3(-7 + 14.0f * (i % side) / side, 5, -7 + 14.0f * (i / side) / side);
+				crowd->Add(jumper);
+			}
+		}
+	}
+
+	const Body * Jumper() const { return b; }
+
+	uint64_t Digest() const { // FNV-1a of the simulated state, equal runs give equal digests
+		std::vector<float> state = { b->translation.x, b->translation.y, b->translation.z, b->v.x, b->v.y, b->v.z,
+		                             b->rotationAngle, b->w.x, b->w.y, b->w.z, b->q.x, b->q.y, b->q.z, b->q.w };
+		if (b->rope) for (vec3 p : b->rope->Particles()) state.insert(state.end(), { p.x, p.y, p.z });
+		if (crowd) {
+			std::vector<vec4> bodies;
+			crowd->Publish(bodies);
+			for (vec4 p : bodies) state.insert(state.end(), { p.x, p.y, p.z, p.w });
+		}
+		state.push_back((float)jumps); // exact below 2^24 launches
+		uint64_t h = 0xcbf29ce484222325ull;
+		const unsigned char * bytes = (const unsigned char *)&state[0];
+		for (size_t i = 0; i < state.size() * sizeof(float); i++) h = (h ^ bytes[i]) * 0x100000001b3ull;
+		return h;
+	}
+
+	void Launch() {
+		if (crowd) crowd->Launch(CounterRNG(worldSeed).Stream(CrowdStream), jumps);
+		b->Launch(CounterRNG(worldSeed).Stream(JumpStream), jumps++);
+	}
+
+	void Animate(float tstart, float tend) { // one physics step
+		b->Animate(tstart, tend);
+		if (crowd) crowd->Animate(tstart, tend);
+		bool stepped = goon && !b->Asleep();
+		if (terrainCollision && !animatedTerrain && stepped) collider.Collide(*b, heightField, tend - tstart); // the field does not follow the drift
+		b->Rest(tend - tstart);
+		if (instrumentPhysics && stepped) probe.Record(b->Measure(tend));
+	}
+
+	bool Resting() const { // every body fell asleep after the launch, on the thread running the physics
+		return sleepAtRest && b->Asleep() && (!crowd || crowd->Asleep());
+	}
+
+	bool Idle() const { return !goon || Resting(); } // no body is stepped: before the launch or at rest
+
+	// After the physics steps, on the thread running them
+	void Publish(SceneSnapshot& snapshot, double time, double dropped) const {
+		snapshot.time = time;
+		snapshot.dropped = dropped;
+		snapshot.prev = b->PrevPose();
+		snapshot.cur = b->Pose();
+		if (b->rope) snapshot.rope = b->rope->Particles();
+		if (crowd) crowd->Publish(snapshot.crowd);
+		snapshot.resting = Resting();
+	}
+};
+
+extern World world;
+
+//---------------------------
+struct SimulationClock { // fixed step simulation time driven by the real time of the frames
+//---------------------------
+	double dt;               // step
+	int maxSteps;            // per frame
+	double time = 0;         // simulated so far
+	double accumulator = 0;  // real time not simulated yet
+	double dropped = 0;      // real time given up to keep up, time + accumulator + dropped is the real time
+	double last = 0;         // real time of the previous frame
+	long steps = 0;          // taken so far
+
+	SimulationClock(double _dt, int _maxSteps) : dt(_dt), maxSteps(_maxSteps) { }
+
+	// Number of steps to take for the frame at real time now
+	int Steps(double now) {
+		accumulator += now - last;
+		last = now;
+		int n = (int)(accumulator / dt);
+		if (n > maxSteps) { // cannot keep up, simulation runs slower than real time instead of spiraling
+			n = maxSteps;
+			dropped += accumulator - n * dt;
+			accumulator = n * dt;
+		}
+		return n;
+	}
+
+	void Step() { time += dt; accumulator -= dt; steps++; }
+
+	float Alpha() const { return (float)(accumulator / dt); } // fraction of the next step already elapsed
+};
+
+//---------------------------
+class SessionLog { // seed, parameters and key presses of a run with the physics step they arrived at, to replay it
+//---------------------------
+	// Binary, native byte order: "JMPS", version, seed, number of parameters and each as its type (uint8) and value
+	// (float, int32 or uint8 for a bool), then events of step (uint32) and type (uint8): a key (uint8) or the end with
+	// the digest of the state (uint64)
+	enum Event : uint8_t { KeyEvent = 1, EndEvent = 2 };
+	enum Type : uint8_t { FloatParameter = 1, IntParameter = 2, BoolParameter = 3 };
+	static const uint16_t version = 3;
+	FILE * file = nullptr;
+	bool replaying = false;
+	long steps = 0;      // taken so far, or to be taken by the replay before it ends
+	long next = -1;      // step of the next replayed event, -1 after the last one
+	Event nextType = EndEvent;
+	uint8_t nextKey = 0;
+	uint64_t recordedDigest = 0;
+	bool reported = false;
+
+	template<class T> void Put(T x) { fwrite(&x, sizeof(T), 1, file); }
+	template<class T> bool Get(T& x) { return fread(&x, sizeof(T), 1, file) == 1; }
+
+	struct Parameter { // logged with its type, read back bit for bit
+		const char * name;
+		Type type;
+		float f = 0;               // FloatParameter
+		int32_t i = 0;             // IntParameter and BoolParameter
+		float * rebuilt = nullptr; // a Body parameter the replay sets, a switch of this build it only compares otherwise
+		int32_t * restored = nullptr; // state of the world the replay sets, like the jump count
+
+		Parameter(const char * _name, float _f, float * _rebuilt = nullptr) : name(_name), type(FloatParameter), f(_f), rebuilt(_rebuilt) { }
+		Parameter(const char * _name, int _i, int32_t * _restored = nullptr) : name(_name), type(IntParameter), i(_i), restored(_restored) { }
+		Parameter(const char * _name, bool _b) : name(_name), type(BoolParameter), i(_b) { }
+
+		bool Same(const Parameter& p) const { return type == p.type && (type == FloatParameter ? memcmp(&f, &p.f, sizeof(f)) == 0 : i == p.i); }
+		double Value() const { return type == FloatParameter ? f : i; }
+	};
+
+	// Of this build, the Body ones are those World builds its jumpers with, and the launches before the recording
+	static std::vector<Parameter> Parameters() {
+		Body& p = world.parameters;
+		return { { "physicsStep", physicsStep }, { "bodyIntegrator", (int)bodyIntegrator }, { "crowdSize", crowdSize },
+		         { "ropeSegments", ropeSegments }, { "eventDrivenRope", eventDrivenRope }, { "rigidBody3D", rigidBody3D },
+		         { "terrainCollision", terrainCollision }, { "fftTerrain", fftTerrain }, { "animatedTerrain", animatedTerrain },
+		         { "D", p.D, &p.D }, { "l0", p.l0, &p.l0 }, { "m", p.m, &p.m }, { "ro", p.ro, &p.ro }, { "kappa", p.kappa, &p.kappa },
+		         { "jumps", world.jumps, &world.jumps } };
+	}
+
+	void Put(const Parameter& p) {
+		Put(p.type);
+		if (p.type == FloatParameter) Put(p.f);
+		else if (p.type == IntParameter) Put(p.i);
+		else Put((uint8_t)p.i);
+	}
+
+	bool Get(Parameter& p) { // of the type read
+		uint8_t type, b;
+		if (!Get(type)) return false;
+		p.type = (Type)type;
+		if (type == FloatParameter) return Get(p.f);
+		if (type == IntParameter) return Get(p.i);
+		if (type != BoolParameter || !Get(b)) return false;
+		p.i = b;
+		return true;
+	}
+
+	void ReadEvent() {
+		uint32_t step;
+		uint8_t type;
+		if (!Get(step) || !Get(type) || (type == KeyEvent ? !Get(nextKey) : !Get(recordedDigest))) {
+			next = -1; // cut short by a crash: the replay goes on without input
+			return;
+		}
+		next = step;
+		nextType = (Event)type;
+	}
+public:
+	float Speed() const { return replaying ? replaySpeed : 1; } // simulated per real time
+
+	bool Record(const char * path) {
+		if (!(file = fopen(path, "wb"))) return false;
+		fwrite("JMPS", 1, 4, file);
+		Put(version);
+		Put(worldSeed);
+		std::vector<Parameter> parameters = Parameters();
+		Put((uint16_t)parameters.size());
+		for (auto& p : parameters) Put(p);
+		fflush(file);
+		return true;
+	}
+
+	// Before the world builds the bodies, which then get the logged Body parameters and jump count
+	bool Replay(const char * path) {
+		char magic[4];
+		uint16_t v, n;
+		uint64_t seed;
+		bool valid = (file = fopen(path, "rb")) && fread(magic, 1, 4, file) == 4 && memcmp(magic, "JMPS", 4) == 0 && Get(v)
+		             && v == version && Get(seed) && Get(n);
+		if (valid && seed != worldSeed)
+			printf("session seed %llu differs from %llu\n", (unsigned long long)seed, (unsigned long long)worldSeed);
+		std::vector<Parameter> parameters = Parameters();
+		for (int i = 0; valid && i < n; i++) {
+			Parameter logged("", 0);
+			valid = Get(logged);
+			if (!valid || i >= (int)parameters.size() || logged.Same(parameters[i])) continue;
+			if (parameters[i].rebuilt && logged.type == FloatParameter) *parameters[i].rebuilt = logged.f;
+			else if (parameters[i].restored && logged.type == IntParameter) *parameters[i].restored = logged.i;
+			else printf("session %s = %g differs from %g, the replay will diverge\n", parameters[i].name, logged.Value(), parameters[i].Value());
+		}
+		if (!valid) {
+			printf("%s is not a session log\n", path);
+			if (file) fclose(file);
+			file = nullptr; // nothing to end at exit
+			return false;
+		}
+		replaying = true;
+		ReadEvent();
+		return true;
+	}
+
+	// Before the step-th physics step: the number of key presses it gets, -1 if the replayed session is over.
+	// key is the one pressed since the previous step (0 if none), logged when recording and ignored when replaying.
+	int Input(long step, int key) {
+		steps = replaying ? step : step + 1;
+		if (!replaying) {
+			if (key && file) {
+				Put((uint32_t)step);
+				Put((uint8_t)KeyEvent);
+				Put((uint8_t)key);
+				fflush(file); // the log survives a crash
+			}
+			return key ? 1 : 0;
+		}
+		int presses = 0;
+		while (next == step) {
+			if (nextType == EndEvent) {
+				if (!reported) printf("replay over after %ld steps, the state %s the recording\n", step,
+				                      world.Digest() == recordedDigest ? "matches" : "DIFFERS from");
+				reported = true;
+				return -1;
+			}
+			presses++;
+			ReadEvent();
+		}
+		return presses;
+	}
+
+	bool Over() const { return replaying && next == steps && nextType == EndEvent; }
+	bool Exhausted() const { return replaying && next < 0; } // no more events and no end: the log was cut short
+
+	uint64_t RecordedDigest() const { return recordedDigest; }
+
+	~SessionLog() { // at exit, after the physics thread stopped
+		if (!file) return;
+		if (!replaying) {
+			Put((uint32_t)steps);
+			Put((uint8_t)EndEvent);
+			Put(world.Digest());
+		}
+		fclose(file);
+	}
+};
+
+extern SessionLog session;
+
+extern std::atomic<int> pressedKey; // by the keyboard, taken by the next physics step
+
+// Steps of the world due at real time now, a key press launches the jumper from the platform or from rest
+int Simulate(SimulationClock& clock, double now);
+
+// Runs a session log as fast as possible without a window, nonzero if the final state does not match the recorded one
+int ReplaySession(const char * path, const char * probePath);
+
+// Monte-Carlo safety envelope of the jumper over many launches, statistics as CSV on out
+void SimulateJumps(long nLaunches, float D, float l0, float m, float duration = 10, int nThreads = 0, FILE * out = stdout);
+
+// Benchmarks printed at startup of the window with the benchmark switches
+void BenchmarkIntegrators(float duration = 20);
+void BenchmarkCrowd(int nSteps = 2000, float dt = 0.001f);
+void BenchmarkEvents(float duration = 10);
+void BenchmarkThreads(int maxThreads = std::max(1, (int)std::thread::hardware_concurrency()), float dt = 0.001f);
+void BenchmarkBroadphase(int maxThreads = std::max(1, (int)std::thread::hardware_concurrency()));
+void BenchmarkTunneling(float duration = 2);
+void BenchmarkRope(float duration = 3);
+
+// Checks and benchmarks by name without a window, for jumpsim --check and --benchmark
+int RunChecks(); // number of failed checks
+bool RunBenchmark(const char * name);
+
+//---------------------------
+class PhysicsThread { // steps the world in real time on its own thread, publishing a snapshot after each batch of steps
+//---------------------------
+	SimulationClock clock = SimulationClock(physicsStep, maxStepsPerFrame);
+	TripleBuffer<SceneSnapshot> snapshots;
+	std::chrono::steady_clock::time_point epoch;
+	std::atomic<bool> quit{ false };
+	std::thread thread;
+
+	void Run() {
+		while (!quit) {
+			if (Simulate(clock, Now()) > 0) {
+				world.Publish(snapshots.Back(), clock.time, clock.dropped);
+				snapshots.Publish();
+			}
+			double wait = world.Idle() ? sleepPoll : clock.dt - clock.accumulator; // to the next step that does something
+			std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
+	}
+public:
+	double Now() const { return session.Speed() * std::chrono::duration<double>(std::chrono::steady_clock::now() - epoch).count(); }
+
+	void Start() {
+		epoch = std::chrono::steady_clock::now();
+		world.Publish(snapshots.Back(), 0, 0); // drawn until the first step
+		snapshots.Publish();
+		thread = std::thread(&PhysicsThread::Run, this);
+	}
+
+	const SceneSnapshot& Latest() { return snapshots.Latest(); } // never waits for the physics
+
+	~PhysicsThread() { // before the world it steps is destroyed
+		quit = true;
+		if (thread.joinable()) thread.join();
+	}
+};
+
+extern PhysicsThread physics;